@@ -0,0 +1,153 @@
+/*
+ * Condition variable broadcast benchmark
+ *
+ * A releaser thread repeatedly waits for all the waiter threads to be blocked,
+ * then releases them all at once. The release goes from the first call of the
+ * releaser to its last, and a round from the release to the moment all the
+ * waiters are blocked again.
+ *
+ * The run is done without preemption, once per way of releasing the waiters:
+ * - sem: each waiter blocks on its own semaphore, which the releaser ups one
+ *   after the other
+ * - cond: the waiters wait on a condition variable with a mutex, and the
+ *   releaser broadcasts it once
+ *
+ * The results are printed as CSV, one line per way and number of waiters:
+ * primitive,waiters,rounds,release_us,round_us
+ *
+ * Usage: cond_bench.x [rounds]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <mutex.h>
+#include <sem.h>
+#include <uthread.h>
+
+static const long populations[] = { 10, 100, 1000, 10000 };
+
+#define POPULATIONS (int)(sizeof(populations) / sizeof(populations[0]))
+
+static long rounds = 100;
+static long waiters;
+static int use_cond;
+
+static sem_t *sems;
+static uthread_mutex_t mutex;
+static uthread_cond_t cond;
+static long generation;
+static long blocked;
+static int64_t release_time;
+static int64_t round_time;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void waiter(void *arg)
+{
+	long id = (long)arg;
+
+	for (long r = 0; r < rounds; r++) {
+		if (use_cond) {
+			uthread_mutex_lock(mutex);
+			blocked++;
+			while (generation == r)
+				uthread_cond_wait(cond, mutex);
+			uthread_mutex_unlock(mutex);
+		} else {
+			blocked++;
+			sem_down(sems[id]);
+		}
+	}
+}
+
+static void releaser(void *arg)
+{
+	int64_t begin, released;
+	(void)arg;
+
+	for (long r = 0; r < rounds; r++) {
+		while (blocked < waiters)
+			uthread_yield();
+
+		begin = now();
+		if (use_cond) {
+			uthread_mutex_lock(mutex);
+			blocked = 0;
+			generation++;
+			uthread_cond_broadcast(cond);
+			uthread_mutex_unlock(mutex);
+		} else {
+			blocked = 0;
+			for (long i = 0; i < waiters; i++)
+				sem_up(sems[i]);
+		}
+		released = now();
+		release_time += released - begin;
+
+		/* The last round ends with the waiters exiting */
+		if (r < rounds - 1) {
+			while (blocked < waiters)
+				uthread_yield();
+			round_time += now() - begin;
+		}
+	}
+}
+
+static void start(void *arg)
+{
+	(void)arg;
+
+	for (long i = 0; i < waiters; i++)
+		uthread_create(waiter, (void *)i);
+	uthread_create(releaser, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		rounds = atol(argv[1]);
+	if (rounds <= 1)
+		return 1;
+
+	printf("primitive,waiters,rounds,release_us,round_us\n");
+	for (use_cond = 0; use_cond < 2; use_cond++) {
+		for (int p = 0; p < POPULATIONS; p++) {
+			waiters = populations[p];
+			sems = malloc(waiters * sizeof(*sems));
+			for (long i = 0; i < waiters; i++)
+				sems[i] = sem_create(0);
+			mutex = uthread_mutex_create();
+			cond = uthread_cond_create();
+			generation = 0;
+			blocked = 0;
+			release_time = 0;
+			round_time = 0;
+
+			if (uthread_run(false, start, NULL)) {
+				fprintf(stderr, "cond_bench: run failed\n");
+				return 1;
+			}
+
+			uthread_cond_destroy(cond);
+			uthread_mutex_destroy(mutex);
+			for (long i = 0; i < waiters; i++)
+				sem_destroy(sems[i]);
+			free(sems);
+
+			printf("%s,%ld,%ld,%.2f,%.2f\n",
+			       use_cond ? "cond" : "sem", waiters, rounds,
+			       release_time / 1e3 / rounds,
+			       round_time / 1e3 / (rounds - 1));
+		}
+	}
+	return 0;
+}
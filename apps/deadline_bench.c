@@ -0,0 +1,175 @@
+/*
+ * Deadline scheduling benchmark
+ *
+ * A handler thread must reply to each request within a budget, while
+ * CPU-bound batch threads keep the worker busy. Requests arrive at a fixed
+ * interval, as noticed by the batch threads between chunks of work, like a
+ * poller would, and the handler does some work for each of them. A request is
+ * late when the handler is done with it more than the budget after its
+ * arrival.
+ *
+ * The run is done with preemption, first without deadlines, then with the
+ * handler setting the deadline of each request before waiting for it, with
+ * the default and the fair policies. With deadlines, the library's own
+ * counters are checked against the bench's.
+ *
+ * The results are printed as CSV, one line per mode:
+ * mode,requests,budget_us,late,p99_us,max_us,stats_met,stats_missed
+ *
+ * Usage: deadline_bench.x [requests] [budget in microseconds]
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define BATCH 4
+#define CHUNK 1000
+#define INTERVAL 3000000
+#define SERVICE 100000
+#define QUANTUM 1000
+
+enum mode {
+	MODE_NONE,
+	MODE_EDF,
+	MODE_EDF_FAIR,
+};
+
+static const char *mode_names[] = { "none", "edf", "edf_fair" };
+
+static long requests = 500;
+static long budget = 2000;
+static enum mode mode;
+
+static sem_t arrival;
+static atomic_int pending;
+static volatile int64_t due;
+static volatile int done;
+static int64_t *latencies;
+static uint64_t sink;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t work(uint64_t value, int rounds)
+{
+	for (int i = 0; i < rounds; i++) {
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+	}
+	return value;
+}
+
+/* CPU-bound thread, also noticing the arrival of requests */
+static void batch(void *arg)
+{
+	uint64_t value = (long)arg;
+
+	while (!done) {
+		value = work(value, CHUNK);
+		if (atomic_load(&pending) && now() >= due
+		    && atomic_exchange(&pending, 0))
+			sem_up(arrival);
+	}
+	sink += value;
+}
+
+static void handler(void *arg)
+{
+	uint64_t value = 1;
+	(void)arg;
+
+	for (long i = 0; i < requests; i++) {
+		/* Wait for the next request, already on the clock for it */
+		due = now() + INTERVAL;
+		if (mode != MODE_NONE)
+			uthread_set_deadline((INTERVAL / 1000) + budget);
+		atomic_store(&pending, 1);
+		sem_down(arrival);
+
+		value = work(value, SERVICE);
+		latencies[i] = now() - due;
+		if (mode != MODE_NONE)
+			uthread_set_deadline(0);
+	}
+
+	done = 1;
+	sink += value;
+}
+
+static void start(void *arg)
+{
+	(void)arg;
+
+	uthread_create(handler, NULL);
+	for (long i = 1; i <= BATCH; i++)
+		uthread_create(batch, (void *)i);
+}
+
+static int compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	struct uthread_deadline_stats before, after;
+
+	if (argc > 1)
+		requests = atol(argv[1]);
+	if (argc > 2)
+		budget = atol(argv[2]);
+	if (requests <= 0)
+		return 1;
+
+	latencies = malloc(requests * sizeof(*latencies));
+	arrival = sem_create(0);
+
+	printf("mode,requests,budget_us,late,p99_us,max_us,stats_met,"
+	       "stats_missed\n");
+	for (mode = MODE_NONE; mode <= MODE_EDF_FAIR; mode++) {
+		uthread_run_attr_t attr;
+		long late = 0;
+
+		uthread_run_attr_init(&attr);
+		attr.preempt = true;
+		attr.clock = CLOCK_MONOTONIC;
+		attr.quantum = QUANTUM;
+		if (mode == MODE_EDF_FAIR)
+			attr.policy = &uthread_policy_fair;
+
+		done = 0;
+		uthread_deadline_get_stats(&before);
+		if (uthread_run_ex(&attr, start, NULL)) {
+			fprintf(stderr, "deadline_bench: run failed\n");
+			return 1;
+		}
+		uthread_deadline_get_stats(&after);
+
+		qsort(latencies, requests, sizeof(*latencies), compare);
+		for (long i = 0; i < requests; i++)
+			late += latencies[i] > budget * 1000;
+		printf("%s,%ld,%ld,%ld,%.1f,%.1f,%zu,%zu\n", mode_names[mode],
+		       requests, budget, late,
+		       latencies[requests * 99 / 100] / 1e3,
+		       latencies[requests - 1] / 1e3,
+		       after.met - before.met, after.missed - before.missed);
+	}
+
+	sem_destroy(arrival);
+	free(latencies);
+	return sink == 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Fair-share scheduling benchmark
+ *
+ * Runs the CPU-bound threads of three tenants for a fixed time, with
+ * preemption, and measures the share of the CPU each tenant got from the
+ * chunks of work its threads completed:
+ * - many: 4 threads of weight 256, 1024 in total
+ * - one: 1 thread of the default weight, 1024
+ * - double: 1 thread of weight 2048
+ *
+ * In round-robin, every thread gets the same share, so the tenant with the
+ * most threads gets most of the CPU. With the fair policy, the shares follow
+ * the weights of the tenants, whatever their number of threads. The fair
+ * policy is run twice: with the weights set at creation, and with threads
+ * created with the default weight that set their own with uthread_set_weight()
+ * once running.
+ *
+ * The shares are checked to be within SLACK percent of the expected ones. The
+ * results are printed as CSV, one line per mode and tenant:
+ * mode,tenant,threads,weight,share_pct,expected_pct
+ *
+ * Usage: fair_bench.x [milliseconds] [quantum in microseconds]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define CHUNK 1000
+#define SLACK 5.0
+
+enum mode {
+	MODE_RR,
+	MODE_FAIR,
+	MODE_REWEIGHTED,
+};
+
+static const char *mode_names[] = { "rr", "fair", "reweighted" };
+
+struct tenant {
+	const char *name;
+	int threads;
+	int weight;
+	long chunks;
+};
+
+static struct tenant tenants[] = {
+	{ "many", 4, 256, 0 },
+	{ "one", 1, 1024, 0 },
+	{ "double", 1, 2048, 0 },
+};
+
+#define TENANTS (int)(sizeof(tenants) / sizeof(tenants[0]))
+
+static long duration = 1000;
+static long quantum = 1000;
+static enum mode mode;
+static volatile int failed;
+static int64_t end;
+static uint64_t sink;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void spin(void *arg)
+{
+	struct tenant *tenant = arg;
+	uint64_t value = tenant->weight;
+
+	if (mode == MODE_REWEIGHTED && (uthread_set_weight(0) != -1
+					|| uthread_set_weight(tenant->weight)))
+		failed = 1;
+	while (now() < end) {
+		for (int i = 0; i < CHUNK; i++) {
+			value ^= value << 13;
+			value ^= value >> 7;
+			value ^= value << 17;
+		}
+		tenant->chunks++;
+	}
+	sink += value;
+}
+
+static void start(void *arg)
+{
+	uthread_attr_t attr;
+	(void)arg;
+
+	end = now() + duration * 1000000;
+	for (int t = 0; t < TENANTS; t++) {
+		uthread_attr_init(&attr);
+		if (mode != MODE_REWEIGHTED)
+			uthread_attr_setweight(&attr, tenants[t].weight);
+		for (int i = 0; i < tenants[t].threads; i++)
+			uthread_create_ex(&attr, spin, &tenants[t]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		duration = atol(argv[1]);
+	if (argc > 2)
+		quantum = atol(argv[2]);
+
+	printf("mode,tenant,threads,weight,share_pct,expected_pct\n");
+	for (mode = MODE_RR; mode <= MODE_REWEIGHTED; mode++) {
+		bool fair = mode != MODE_RR;
+		uthread_run_attr_t attr;
+		long total = 0, threads = 0, weights = 0;
+
+		uthread_run_attr_init(&attr);
+		attr.preempt = true;
+		attr.clock = CLOCK_MONOTONIC;
+		attr.quantum = quantum;
+		if (fair)
+			attr.policy = &uthread_policy_fair;
+
+		for (int t = 0; t < TENANTS; t++)
+			tenants[t].chunks = 0;
+		if (uthread_run_ex(&attr, start, NULL)) {
+			fprintf(stderr, "fair_bench: run failed\n");
+			return 1;
+		}
+		if (failed) {
+			fprintf(stderr, "fair_bench: setting weight failed\n");
+			return 1;
+		}
+
+		for (int t = 0; t < TENANTS; t++) {
+			total += tenants[t].chunks;
+			threads += tenants[t].threads;
+			weights += tenants[t].threads * tenants[t].weight;
+		}
+		for (int t = 0; t < TENANTS; t++) {
+			struct tenant *tenant = &tenants[t];
+			double expected = fair
+				? 100.0 * tenant->threads * tenant->weight / weights
+				: 100.0 * tenant->threads / threads;
+			double share = 100.0 * tenant->chunks / total;
+
+			printf("%s,%s,%d,%d,%.1f,%.1f\n", mode_names[mode],
+			       tenant->name, tenant->threads, tenant->weight,
+			       share, expected);
+			if (share < expected - SLACK || share > expected + SLACK)
+				failed = 1;
+		}
+		if (failed) {
+			fprintf(stderr, "fair_bench: shares do not follow the "
+				"weights\n");
+			return 1;
+		}
+	}
+
+	return sink == 0;
+}
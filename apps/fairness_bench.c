@@ -0,0 +1,157 @@
+/*
+ * Semaphore fairness benchmark
+ *
+ * Threads contend for a semaphore used as a lock, with preemption: each one
+ * takes it, works for a while in the critical section, releases it, then works
+ * as long outside of it, until the run is over. A thread preempted in the
+ * critical section makes the others wait for it. The wait of an acquisition
+ * goes from the call to sem_down() to its return.
+ *
+ * The run is done once per semaphore mode:
+ * - default: sem_create(), the woken up waiter takes the lock if it is still
+ *   free once it runs, or else waits again at the back of the line
+ * - fifo: SEM_FIFO, released units go to the waiters in order
+ * - barge: SEM_BARGE, any thread takes a free lock, without waking up more
+ *   waiters than there are units
+ *
+ * The results are printed as CSV, one line per mode:
+ * mode,threads,acquisitions_per_ms,wait_p50_us,wait_p99_us,wait_max_us,
+ * min_share_pct,max_share_pct
+ * where the shares are those of the acquisitions of the least and most lucky
+ * threads.
+ *
+ * Usage: fairness_bench.x [milliseconds] [threads]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define CHUNK 200
+#define QUANTUM 100
+#define MAX_WAITS (1 << 20)
+#define MAX_THREADS 64
+
+static const char *mode_names[] = { "default", "fifo", "barge" };
+static const int mode_flags[] = { 0, SEM_FIFO, SEM_BARGE };
+
+#define MODES (int)(sizeof(mode_flags) / sizeof(mode_flags[0]))
+
+static long duration = 500;
+static long threads = 8;
+
+static sem_t lock;
+static int64_t end;
+static int64_t *waits;
+static long num_waits;
+static long acquisitions[MAX_THREADS];
+static uint64_t sink;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t work(uint64_t value)
+{
+	for (int i = 0; i < CHUNK; i++) {
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+	}
+	return value;
+}
+
+static void contender(void *arg)
+{
+	long id = (long)arg;
+	uint64_t value = id + 1;
+	int64_t begin;
+
+	while ((begin = now()) < end) {
+		sem_down(lock);
+		if (num_waits < MAX_WAITS)
+			waits[num_waits++] = now() - begin;
+		acquisitions[id]++;
+		value = work(value);
+		sem_up(lock);
+
+		value = work(value);
+	}
+	sink += value;
+}
+
+static void start(void *arg)
+{
+	(void)arg;
+
+	end = now() + duration * 1000000;
+	for (long i = 0; i < threads; i++)
+		uthread_create(contender, (void *)i);
+}
+
+static int compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		duration = atol(argv[1]);
+	if (argc > 2)
+		threads = atol(argv[2]);
+	if (duration <= 0 || threads <= 0 || threads > MAX_THREADS)
+		return 1;
+
+	waits = malloc(MAX_WAITS * sizeof(*waits));
+
+	printf("mode,threads,acquisitions_per_ms,wait_p50_us,wait_p99_us,"
+	       "wait_max_us,min_share_pct,max_share_pct\n");
+	for (int mode = 0; mode < MODES; mode++) {
+		uthread_run_attr_t attr;
+		long total = 0, least = -1, most = 0;
+
+		uthread_run_attr_init(&attr);
+		attr.preempt = true;
+		attr.clock = CLOCK_MONOTONIC;
+		attr.quantum = QUANTUM;
+
+		lock = sem_create_ex(1, mode_flags[mode]);
+		num_waits = 0;
+		for (long i = 0; i < threads; i++)
+			acquisitions[i] = 0;
+		if (uthread_run_ex(&attr, start, NULL)) {
+			fprintf(stderr, "fairness_bench: run failed\n");
+			return 1;
+		}
+		sem_destroy(lock);
+
+		for (long i = 0; i < threads; i++) {
+			total += acquisitions[i];
+			if (least < 0 || acquisitions[i] < least)
+				least = acquisitions[i];
+			if (acquisitions[i] > most)
+				most = acquisitions[i];
+		}
+		qsort(waits, num_waits, sizeof(*waits), compare);
+		printf("%s,%ld,%.1f,%.2f,%.2f,%.2f,%.1f,%.1f\n",
+		       mode_names[mode], threads, (double)total / duration,
+		       waits[num_waits / 2] / 1e3,
+		       waits[num_waits * 99 / 100] / 1e3,
+		       waits[num_waits - 1] / 1e3,
+		       100.0 * least / total, 100.0 * most / total);
+	}
+
+	free(waits);
+	return sink == 0;
+}
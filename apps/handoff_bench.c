@@ -0,0 +1,182 @@
+/*
+ * Semaphore handoff latency benchmark
+ *
+ * Items go through a deep chain of filter threads, each passing them on to the
+ * next through a channel made of two semaphores, as in sem_prime.c. Bystander
+ * threads keep yielding meanwhile, so that a thread woken up by a channel waits
+ * behind them before it runs. The latency of an item goes from the source
+ * sending it to the sink getting it, and a hop is its latency divided by the
+ * number of channels it went through.
+ *
+ * The run is done once per semaphore mode:
+ * - wake: sem_create(), the woken up thread takes the count once it runs
+ * - handoff: SEM_HANDOFF, the woken up thread is handed the count
+ * - direct: SEM_DIRECT, sem_up() also switches to the woken up thread
+ *
+ * The results are printed as CSV, one line per mode:
+ * mode,depth,items,bystanders,hop_p50_us,hop_p99_us,items_per_ms
+ *
+ * Usage: handoff_bench.x [depth] [items] [bystanders]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+struct channel {
+	int64_t value;
+	sem_t produce;
+	sem_t consume;
+};
+
+static const char *mode_names[] = { "wake", "handoff", "direct" };
+static const int mode_flags[] = { 0, SEM_HANDOFF, SEM_DIRECT };
+
+#define MODES (int)(sizeof(mode_flags) / sizeof(mode_flags[0]))
+
+static long depth = 64;
+static long items = 2000;
+static long bystanders = 8;
+
+static struct channel *channels;
+static int64_t *latencies;
+static volatile int done;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void send(struct channel *c, int64_t value)
+{
+	c->value = value;
+	sem_up(c->consume);
+	sem_down(c->produce);
+}
+
+static int64_t receive(struct channel *c)
+{
+	int64_t value;
+
+	sem_down(c->consume);
+	value = c->value;
+	sem_up(c->produce);
+	return value;
+}
+
+/* Sends the creation time of each item, then -1 */
+static void source(void *arg)
+{
+	(void)arg;
+
+	for (long i = 0; i < items; i++)
+		send(&channels[0], now());
+	send(&channels[0], -1);
+}
+
+/* Passes items from one channel to the next */
+static void filter(void *arg)
+{
+	long i = (long)arg;
+	int64_t value;
+
+	do {
+		value = receive(&channels[i]);
+		send(&channels[i + 1], value);
+	} while (value != -1);
+}
+
+static void sink(void *arg)
+{
+	int64_t value;
+	long i = 0;
+	(void)arg;
+
+	while ((value = receive(&channels[depth])) != -1)
+		latencies[i++] = now() - value;
+	done = 1;
+}
+
+static void bystander(void *arg)
+{
+	(void)arg;
+
+	while (!done)
+		uthread_yield();
+}
+
+static void start(void *arg)
+{
+	(void)arg;
+
+	for (long i = 0; i < bystanders; i++)
+		uthread_create(bystander, NULL);
+	uthread_create(sink, NULL);
+	for (long i = 0; i < depth; i++)
+		uthread_create(filter, (void *)i);
+	uthread_create(source, NULL);
+}
+
+static int compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		depth = atol(argv[1]);
+	if (argc > 2)
+		items = atol(argv[2]);
+	if (argc > 3)
+		bystanders = atol(argv[3]);
+	if (depth <= 0 || items <= 0 || bystanders < 0)
+		return 1;
+
+	channels = malloc((depth + 1) * sizeof(*channels));
+	latencies = malloc(items * sizeof(*latencies));
+
+	printf("mode,depth,items,bystanders,hop_p50_us,hop_p99_us,"
+	       "items_per_ms\n");
+	for (int mode = 0; mode < MODES; mode++) {
+		int64_t begin, elapsed;
+
+		for (long i = 0; i <= depth; i++) {
+			channels[i].produce = sem_create_ex(0, mode_flags[mode]);
+			channels[i].consume = sem_create_ex(0, mode_flags[mode]);
+		}
+
+		done = 0;
+		begin = now();
+		if (uthread_run(false, start, NULL)) {
+			fprintf(stderr, "handoff_bench: run failed\n");
+			return 1;
+		}
+		elapsed = now() - begin;
+
+		for (long i = 0; i <= depth; i++) {
+			sem_destroy(channels[i].produce);
+			sem_destroy(channels[i].consume);
+		}
+
+		qsort(latencies, items, sizeof(*latencies), compare);
+		printf("%s,%ld,%ld,%ld,%.2f,%.2f,%.1f\n", mode_names[mode],
+		       depth, items, bystanders,
+		       latencies[items / 2] / 1e3 / (depth + 1),
+		       latencies[items * 99 / 100] / 1e3 / (depth + 1),
+		       items * 1e6 / elapsed);
+	}
+
+	free(latencies);
+	free(channels);
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Mutex benchmark
+ *
+ * Threads increment a shared counter in a critical section, guarded either by
+ * a semaphore of count 1 or by a mutex, a fixed number of times each. The cost
+ * of an increment covers locking, the increment and unlocking.
+ *
+ * The run is done once per lock and per case:
+ * - uncontended: a single thread, without preemption, so that every lock and
+ *   unlock takes the fast path
+ * - contended: threads preempted with 100 us slices of CLOCK_MONOTONIC, in
+ *   the critical section now and then, on a single worker
+ * - parallel: the same on 4 workers, where threads also contend for the lock
+ *   from different kernel threads
+ *
+ * The counter is checked against its expected value. The results are printed
+ * as CSV, one line per lock and case:
+ * lock,case,workers,threads,ns_per_increment
+ *
+ * Usage: mutex_bench.x [increments per thread] [threads]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <mutex.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define QUANTUM 100
+
+struct bench_case {
+	const char *name;
+	int workers;
+	bool preempt;
+	bool single;
+};
+
+static const struct bench_case cases[] = {
+	{ "uncontended", 1, false, true },
+	{ "contended", 1, true, false },
+	{ "parallel", 4, true, false },
+};
+
+#define CASES (int)(sizeof(cases) / sizeof(cases[0]))
+
+static long increments = 1000000;
+static long threads = 8;
+
+static bool use_mutex;
+static sem_t sem;
+static uthread_mutex_t mutex;
+static volatile long counter;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void incrementer(void *arg)
+{
+	(void)arg;
+
+	if (use_mutex) {
+		for (long i = 0; i < increments; i++) {
+			uthread_mutex_lock(mutex);
+			counter++;
+			uthread_mutex_unlock(mutex);
+		}
+	} else {
+		for (long i = 0; i < increments; i++) {
+			sem_down(sem);
+			counter++;
+			sem_up(sem);
+		}
+	}
+}
+
+static void start(void *arg)
+{
+	long n = (long)arg;
+
+	for (long i = 0; i < n; i++)
+		uthread_create(incrementer, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		increments = atol(argv[1]);
+	if (argc > 2)
+		threads = atol(argv[2]);
+	if (increments <= 0 || threads <= 0)
+		return 1;
+
+	printf("lock,case,workers,threads,ns_per_increment\n");
+	for (int lock = 0; lock < 2; lock++) {
+		use_mutex = lock == 1;
+		for (int c = 0; c < CASES; c++) {
+			uthread_run_attr_t attr;
+			long n = cases[c].single ? 1 : threads;
+			int64_t begin, elapsed;
+
+			uthread_run_attr_init(&attr);
+			attr.workers = cases[c].workers;
+			attr.preempt = cases[c].preempt;
+			attr.clock = CLOCK_MONOTONIC;
+			attr.quantum = QUANTUM;
+
+			sem = sem_create(1);
+			mutex = uthread_mutex_create();
+			counter = 0;
+			begin = now();
+			if (uthread_run_ex(&attr, start, (void *)n)) {
+				fprintf(stderr, "mutex_bench: run failed\n");
+				return 1;
+			}
+			elapsed = now() - begin;
+			if (counter != n * increments) {
+				fprintf(stderr, "mutex_bench: counter is %ld, "
+					"expected %ld\n", counter, n * increments);
+				return 1;
+			}
+			if (sem_destroy(sem) || uthread_mutex_destroy(mutex)) {
+				fprintf(stderr, "mutex_bench: destroy failed\n");
+				return 1;
+			}
+
+			printf("%s,%s,%d,%ld,%.1f\n", use_mutex ? "mutex" : "sem",
+			       cases[c].name, cases[c].workers, n,
+			       (double)elapsed / (n * increments));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,344 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <mutex.h>
+#include <sem.h>
+#include <uthread.h>
+
+// Tester
+// ============================================================================
+#define TEST_ASSERT(assert)             \
+do {                                    \
+    printf("ASSERT: " #assert " ... "); \
+    if (assert) {                       \
+        printf("PASS\n");               \
+    } else  {                           \
+        printf("FAIL\n");               \
+        exit(1);                        \
+    }                                   \
+} while(0)
+
+#define WORKERS 4
+#define QUANTUM 1000
+#define WAITERS 8
+#define TIMEOUT 20000
+#define SETTLE 20000000LL
+#define PATIENCE 2000000000LL
+#define PAIRS 3
+#define ROUNDS 50000
+#define RACE_TIMEOUT 20
+
+// Callbacks / Misc functions
+// ============================================================================
+static uthread_mutex_t mutex;
+static uthread_cond_t cond;
+static int signaled;
+static int waiting;
+static int returned;
+static atomic_int tried;
+static atomic_int finished;
+static atomic_int racing;
+static uthread_mutex_t race_mutex[PAIRS];
+static uthread_cond_t race_cond[PAIRS];
+static sem_t ping[PAIRS];
+static sem_t pong[PAIRS];
+
+/* Monotonic time in nanoseconds */
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Read a counter protected by the mutex */
+static int read_locked(int *counter) {
+    uthread_mutex_lock(mutex);
+    int value = *counter;
+    uthread_mutex_unlock(mutex);
+    return value;
+}
+
+/* Yield until a counter protected by the mutex reaches a value, or give up */
+static int wait_for(int *counter, int value) {
+    int64_t deadline = now() + PATIENCE;
+    while (read_locked(counter) < value && now() < deadline) {
+        uthread_yield();
+    }
+    return read_locked(counter);
+}
+
+/* Yield until the given number of threads are done */
+static void wait_finished(int count) {
+    while (atomic_load(&finished) < count) {
+        uthread_yield();
+    }
+}
+
+/* Try to lock the mutex from another thread, releasing it if taken */
+static void try_locker(void *arg) {
+    (void)arg;
+    int ret = uthread_mutex_trylock(mutex);
+    if (ret == 0) {
+        uthread_mutex_unlock(mutex);
+    }
+    atomic_store(&tried, ret);
+    atomic_fetch_add(&finished, 1);
+}
+
+/* Signal the condition variable once the waiter released the mutex */
+static void signaler(void *arg) {
+    (void)arg;
+    uthread_mutex_lock(mutex);
+    signaled = 1;
+    uthread_cond_signal(cond);
+    uthread_mutex_unlock(mutex);
+    atomic_fetch_add(&finished, 1);
+}
+
+/* Wait on the condition variable once, without checking any condition */
+static void waiter(void *arg) {
+    (void)arg;
+    uthread_mutex_lock(mutex);
+    ++waiting;
+    uthread_cond_wait(cond, mutex);
+    ++returned;
+    uthread_mutex_unlock(mutex);
+    atomic_fetch_add(&finished, 1);
+}
+
+/*
+ * Wait on a condition variable with a timeout about as long as the signaler
+ * takes to signal it, then block on a default semaphore: a timeout coming on
+ * another worker once the signal woke the thread must not cut that block short.
+ * Nobody else takes the mutex, so the semaphore is the next place to block.
+ */
+static void racer(void *arg) {
+    long pair = (long)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        uthread_mutex_lock(race_mutex[pair]);
+        uthread_cond_timedwait(race_cond[pair], race_mutex[pair],
+            RACE_TIMEOUT);
+        uthread_mutex_unlock(race_mutex[pair]);
+        sem_up(ping[pair]);
+        sem_down(pong[pair]);
+    }
+    atomic_fetch_sub(&racing, 1);
+    atomic_fetch_add(&finished, 1);
+}
+
+/* Answer the pings of a racer once it is blocked waiting for the pong */
+static void ponger(void *arg) {
+    long pair = (long)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        sem_down(ping[pair]);
+        uthread_yield();
+        sem_up(pong[pair]);
+    }
+    atomic_fetch_add(&finished, 1);
+}
+
+/* Keep signaling the racers until they are done */
+static void race_signaler(void *arg) {
+    (void)arg;
+    while (atomic_load(&racing) > 0) {
+        for (int i = 0; i < PAIRS; i++) {
+            uthread_cond_signal(race_cond[i]);
+        }
+        uthread_yield();
+    }
+    atomic_fetch_add(&finished, 1);
+}
+
+// Test functions
+// ============================================================================
+/* Test all edge cases of trylock */
+void test_trylock(void) {
+    // Trylock uninitialized mutex
+    TEST_ASSERT(uthread_mutex_trylock(NULL) == -1);
+
+    // Trylock free mutex
+    TEST_ASSERT(uthread_mutex_trylock(mutex) == 0);
+
+    // Trylock mutex held by the caller
+    TEST_ASSERT(uthread_mutex_trylock(mutex) == -1);
+
+    // Trylock mutex held by another thread
+    atomic_store(&finished, 0);
+    uthread_create(try_locker, NULL);
+    wait_finished(1);
+    TEST_ASSERT(atomic_load(&tried) == -1);
+
+    // Unlock, then unlock a mutex the caller does not own
+    TEST_ASSERT(uthread_mutex_unlock(mutex) == 0);
+    TEST_ASSERT(uthread_mutex_unlock(mutex) == -1);
+
+    // Trylock mutex freed by its owner
+    atomic_store(&finished, 0);
+    uthread_create(try_locker, NULL);
+    wait_finished(1);
+    TEST_ASSERT(atomic_load(&tried) == 0);
+
+    // Trylock mutex freed by another thread
+    TEST_ASSERT(uthread_mutex_trylock(mutex) == 0);
+    TEST_ASSERT(uthread_mutex_unlock(mutex) == 0);
+}
+
+/* Test a timed wait that nobody signals */
+void test_timedwait_timeout(void) {
+    uthread_mutex_lock(mutex);
+
+    // Negative timeout
+    TEST_ASSERT(uthread_cond_timedwait(cond, mutex, -1) == -1);
+
+    // Timeout elapsing
+    int64_t begin = now();
+    int ret = uthread_cond_timedwait(cond, mutex, TIMEOUT);
+    int64_t elapsed = now() - begin;
+    TEST_ASSERT(ret == 1);
+    TEST_ASSERT(elapsed >= TIMEOUT * 1000LL);
+
+    uthread_mutex_unlock(mutex);
+}
+
+/* Test a timed wait signaled before its timeout */
+void test_timedwait_signaled(void) {
+    int ret = 0;
+    atomic_store(&finished, 0);
+    signaled = 0;
+
+    // The signaler only gets the mutex once the wait released it
+    uthread_mutex_lock(mutex);
+    uthread_create(signaler, NULL);
+    while (!signaled && ret == 0) {
+        ret = uthread_cond_timedwait(cond, mutex, PATIENCE / 1000);
+    }
+    TEST_ASSERT(ret == 0);
+    TEST_ASSERT(signaled == 1);
+    uthread_mutex_unlock(mutex);
+
+    wait_finished(1);
+}
+
+/* Test that a signal wakes up exactly one waiter */
+void test_signal(void) {
+    atomic_store(&finished, 0);
+    waiting = 0;
+    returned = 0;
+    for (int i = 0; i < WAITERS; i++) {
+        uthread_create(waiter, NULL);
+    }
+    TEST_ASSERT(wait_for(&waiting, WAITERS) == WAITERS);
+
+    uthread_mutex_lock(mutex);
+    uthread_cond_signal(cond);
+    uthread_mutex_unlock(mutex);
+    TEST_ASSERT(wait_for(&returned, 1) == 1);
+
+    // Give any other waiter woken up by mistake the time to return
+    int64_t settle = now() + SETTLE;
+    while (now() < settle) {
+        uthread_yield();
+    }
+    TEST_ASSERT(read_locked(&returned) == 1);
+}
+
+/* Test that a broadcast wakes up all the waiters left */
+void test_broadcast(void) {
+    uthread_mutex_lock(mutex);
+    uthread_cond_broadcast(cond);
+    uthread_mutex_unlock(mutex);
+    TEST_ASSERT(wait_for(&returned, WAITERS) == WAITERS);
+
+    wait_finished(WAITERS);
+}
+
+/* Test timeouts coming once a signal woke up the waiter, on other workers */
+void test_timeout_race(void) {
+    atomic_store(&finished, 0);
+    atomic_store(&racing, PAIRS);
+    for (long i = 0; i < PAIRS; i++) {
+        race_mutex[i] = uthread_mutex_create();
+        race_cond[i] = uthread_cond_create();
+        ping[i] = sem_create(0);
+        pong[i] = sem_create(0);
+        TEST_ASSERT(race_mutex[i] != NULL && race_cond[i] != NULL);
+        TEST_ASSERT(ping[i] != NULL && pong[i] != NULL);
+    }
+    for (long i = 0; i < PAIRS; i++) {
+        uthread_create(racer, (void *)i);
+        uthread_create(ponger, (void *)i);
+    }
+    uthread_create(race_signaler, NULL);
+    wait_finished(2 * PAIRS + 1);
+
+    // Every ping got its pong, and nobody is left waiting
+    for (int i = 0; i < PAIRS; i++) {
+        TEST_ASSERT(sem_destroy(ping[i]) == 0);
+        TEST_ASSERT(sem_destroy(pong[i]) == 0);
+        TEST_ASSERT(uthread_cond_destroy(race_cond[i]) == 0);
+        TEST_ASSERT(uthread_mutex_destroy(race_mutex[i]) == 0);
+    }
+}
+
+/* Test destroying the mutex and the condition variable */
+void test_destroy(void) {
+    // Destroy NULL
+    TEST_ASSERT(uthread_cond_destroy(NULL) == -1);
+    TEST_ASSERT(uthread_mutex_destroy(NULL) == -1);
+
+    // Destroy locked mutex
+    uthread_mutex_lock(mutex);
+    TEST_ASSERT(uthread_mutex_destroy(mutex) == -1);
+    uthread_mutex_unlock(mutex);
+
+    // Destroy normally
+    TEST_ASSERT(uthread_cond_destroy(cond) == 0);
+    TEST_ASSERT(uthread_mutex_destroy(mutex) == 0);
+}
+
+/* Run the tests as a thread, next to the threads they create */
+static void run_tests(void *arg) {
+    (void)arg;
+
+    fprintf(stderr, "*** TEST trylock ***\n");
+    test_trylock();
+
+    fprintf(stderr, "*** TEST timed wait timeout ***\n");
+    test_timedwait_timeout();
+
+    fprintf(stderr, "*** TEST timed wait signaled ***\n");
+    test_timedwait_signaled();
+
+    fprintf(stderr, "*** TEST signal ***\n");
+    test_signal();
+
+    fprintf(stderr, "*** TEST broadcast ***\n");
+    test_broadcast();
+
+    fprintf(stderr, "*** TEST timeout race ***\n");
+    test_timeout_race();
+
+    fprintf(stderr, "*** TEST destroy ***\n");
+    test_destroy();
+}
+
+int main(void) {
+    uthread_run_attr_t attr;
+    uthread_run_attr_init(&attr);
+    attr.workers = WORKERS;
+    attr.preempt = true;
+    attr.clock = CLOCK_MONOTONIC;
+    attr.quantum = QUANTUM;
+
+    mutex = uthread_mutex_create();
+    cond = uthread_cond_create();
+    TEST_ASSERT(mutex != NULL && cond != NULL);
+    int ret = uthread_run_ex(&attr, run_tests, NULL);
+    TEST_ASSERT(ret == 0);
+
+    fprintf(stderr, "*** All test passed ***\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Scheduling policy benchmark
+ *
+ * A dispatcher thread hands out work in bursts: for each task of a burst, it
+ * fills the task's buffer then creates a thread for it, and once the whole
+ * burst is created, it waits for the tasks to be done. Each task reads its
+ * buffer, which is only still in the caches if the task runs soon after the
+ * dispatcher filled it. Its latency goes from its creation to the moment it
+ * starts running.
+ *
+ * The run is done without preemption, once with each built-in policy. With
+ * fifo and mlfq, the oldest task runs first, when its buffer is the coldest.
+ * With lifo, the newest task runs first, which reads its buffer faster at the
+ * cost of the latency of the oldest tasks. With fair, tasks all start with the
+ * same virtual runtime, in no particular order.
+ *
+ * The results are printed as CSV, one line per policy:
+ * policy,tasks,buffer_kib,elapsed_ms,tasks_per_ms,p50_us,p99_us
+ *
+ * Usage: policy_bench.x [rounds] [tasks per burst] [KiB per task]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+static const uthread_policy_t *policies[] = {
+	&uthread_policy_fifo,
+	&uthread_policy_mlfq,
+	&uthread_policy_fair,
+	&uthread_policy_lifo,
+};
+
+#define POLICIES (int)(sizeof(policies) / sizeof(policies[0]))
+
+static long rounds = 20;
+static long burst = 256;
+static long buffer_kib = 64;
+
+static char *buffers;
+static int64_t *created;
+static int64_t *latencies;
+static long round_index;
+static long remaining;
+static sem_t burst_done;
+static uint64_t sink;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void task(void *arg)
+{
+	long i = (long)arg;
+	const uint64_t *buffer = (uint64_t *)(buffers + i * buffer_kib * 1024);
+	uint64_t sum = 0;
+
+	latencies[round_index * burst + i] = now() - created[i];
+	for (size_t j = 0; j < buffer_kib * 1024 / sizeof(*buffer); j++)
+		sum += buffer[j];
+	sink += sum;
+
+	if (--remaining == 0)
+		sem_up(burst_done);
+}
+
+static void dispatcher(void *arg)
+{
+	(void)arg;
+
+	for (round_index = 0; round_index < rounds; round_index++) {
+		remaining = burst;
+		for (long i = 0; i < burst; i++) {
+			memset(buffers + i * buffer_kib * 1024, round_index + i,
+			       buffer_kib * 1024);
+			created[i] = now();
+			uthread_create(task, (void *)i);
+		}
+		sem_down(burst_done);
+	}
+}
+
+static int compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	long tasks;
+
+	if (argc > 1)
+		rounds = atol(argv[1]);
+	if (argc > 2)
+		burst = atol(argv[2]);
+	if (argc > 3)
+		buffer_kib = atol(argv[3]);
+	if (rounds <= 0 || burst <= 0 || buffer_kib <= 0)
+		return 1;
+
+	tasks = rounds * burst;
+	buffers = malloc(burst * buffer_kib * 1024);
+	created = malloc(burst * sizeof(*created));
+	latencies = malloc(tasks * sizeof(*latencies));
+	burst_done = sem_create(0);
+
+	/* Fault the buffers in before the first run */
+	memset(buffers, 0, burst * buffer_kib * 1024);
+
+	printf("policy,tasks,buffer_kib,elapsed_ms,tasks_per_ms,p50_us,p99_us\n");
+	for (int p = 0; p < POLICIES; p++) {
+		uthread_run_attr_t attr;
+		int64_t begin, elapsed;
+
+		uthread_run_attr_init(&attr);
+		attr.policy = policies[p];
+
+		begin = now();
+		if (uthread_run_ex(&attr, dispatcher, NULL)) {
+			fprintf(stderr, "policy_bench: run failed\n");
+			return 1;
+		}
+		elapsed = now() - begin;
+
+		qsort(latencies, tasks, sizeof(*latencies), compare);
+		printf("%s,%ld,%ld,%.1f,%.1f,%.1f,%.1f\n", policies[p]->name,
+		       tasks, buffer_kib, elapsed / 1e6, tasks * 1e6 / elapsed,
+		       latencies[tasks / 2] / 1e3,
+		       latencies[tasks * 99 / 100] / 1e3);
+	}
+
+	sem_destroy(burst_done);
+	free(latencies);
+	free(created);
+	free(buffers);
+	return sink == 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Preemption overhead benchmark
+ *
+ * Runs a fixed amount of CPU-bound work split between threads that never
+ * yield, first without preemption and then with preemption for each clock and
+ * a range of time slices. Every change of running thread is a preemption, so
+ * the extra time taken over the run without preemption gives the cost of each
+ * one, and the share of the run lost to preempting at that rate.
+ *
+ * The same is done with a single thread, which has no other thread to be
+ * preempted for: its overhead is the cost of timer ticks that are of no use.
+ * The scheduler runs on a pthread of its own, like in a service embedding the
+ * library, and the work is done again with ordinary pthreads spinning next to
+ * it: the alarms must reach the scheduler's kernel thread rather than the main
+ * thread waiting for it or the other pthreads.
+ *
+ * The results are printed as CSV, one line per clock, time slice, number of
+ * threads and number of pthreads:
+ * clock,quantum_us,threads,pthreads,ms,preemptions,overhead_pct,
+ * ns_per_preemption
+ *
+ * A run no slower than the one without preemption leaves the overhead and the
+ * cost of a preemption to noise, and fewer than MIN_PREEMPTIONS preemptions
+ * leave the cost of one to noise: those are printed as NA.
+ *
+ * Usage: preempt_bench.x [iterations]
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define THREADS 4
+#define PTHREADS 2
+#define MIN_PREEMPTIONS 100
+
+static long iterations = 100000000;
+static long threads;
+static volatile int last_thread;
+static long preemptions;
+static uint64_t sink;
+static volatile int background_stop;
+
+struct load {
+	long threads;
+	int pthreads;
+};
+
+static const struct load loads[] = {
+	{ THREADS, 0 },
+	{ 1, 0 },
+	{ THREADS, PTHREADS },
+};
+
+struct clock_case {
+	const char *name;
+	clockid_t clock;
+};
+
+static const struct clock_case clocks[] = {
+	{ "process", CLOCK_PROCESS_CPUTIME_ID },
+	{ "monotonic", CLOCK_MONOTONIC },
+	{ "thread", CLOCK_THREAD_CPUTIME_ID },
+};
+
+static const long quanta[] = { 10000, 1000, 500, 200, 100, 50, 20 };
+
+static void spin(void *arg)
+{
+	int id = (long)arg;
+	uint64_t value = id + 1;
+
+	for (long i = 0; i < iterations / threads; i++) {
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+		/* Some other thread ran since our last iteration */
+		if (last_thread != id) {
+			last_thread = id;
+			preemptions++;
+		}
+	}
+	sink += value;
+}
+
+/* Ordinary pthread of the process, busy next to the scheduler */
+static void *background(void *arg)
+{
+	(void)arg;
+
+	while (!background_stop) {
+	}
+	return NULL;
+}
+
+static void start(void *arg)
+{
+	(void)arg;
+
+	for (long i = 1; i <= threads; i++)
+		uthread_create(spin, (void *)i);
+}
+
+/* Scheduler side of a run, on a pthread of its own */
+static void *run_scheduler(void *arg)
+{
+	if (uthread_run_ex(arg, start, NULL)) {
+		fprintf(stderr, "preempt_bench: run failed\n");
+		exit(1);
+	}
+	return NULL;
+}
+
+/* Time a run of the work of @nthreads threads in milliseconds */
+static double run(long nthreads, bool preempt, clockid_t clock, long quantum)
+{
+	uthread_run_attr_t attr;
+	struct timespec begin, end;
+	pthread_t scheduler;
+
+	uthread_run_attr_init(&attr);
+	attr.preempt = preempt;
+	attr.clock = clock;
+	attr.quantum = quantum;
+
+	threads = nthreads;
+	last_thread = 0;
+	preemptions = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	pthread_create(&scheduler, NULL, run_scheduler, &attr);
+	pthread_join(scheduler, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* Each thread entering counts as a switch as well */
+	preemptions -= threads;
+	return (end.tv_sec - begin.tv_sec) * 1e3
+		+ (end.tv_nsec - begin.tv_nsec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t pthreads[PTHREADS];
+
+	if (argc > 1)
+		iterations = atol(argv[1]);
+
+	printf("clock,quantum_us,threads,pthreads,ms,preemptions,overhead_pct,"
+	       "ns_per_preemption\n");
+	for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+		const struct load *load = &loads[l];
+		double base;
+
+		background_stop = 0;
+		for (int i = 0; i < load->pthreads; i++)
+			pthread_create(&pthreads[i], NULL, background, NULL);
+
+		base = run(load->threads, false, CLOCK_MONOTONIC,
+			   UTHREAD_QUANTUM);
+		printf("none,0,%ld,%d,%.1f,%ld,0.0,0\n", load->threads,
+		       load->pthreads, base, preemptions);
+		for (size_t c = 0; c < sizeof(clocks) / sizeof(clocks[0]); c++) {
+			for (size_t q = 0; q < sizeof(quanta) / sizeof(quanta[0]);
+			     q++) {
+				double ms = run(load->threads, true,
+						clocks[c].clock, quanta[q]);
+
+				printf("%s,%ld,%ld,%d,%.1f,%ld,", clocks[c].name,
+				       quanta[q], load->threads, load->pthreads,
+				       ms, preemptions);
+				if (ms <= base)
+					printf("NA,NA\n");
+				else if (preemptions < MIN_PREEMPTIONS)
+					printf("%.1f,NA\n",
+					       (ms - base) / base * 100);
+				else
+					printf("%.1f,%.0f\n",
+					       (ms - base) / base * 100,
+					       (ms - base) * 1e6 / preemptions);
+			}
+		}
+
+		background_stop = 1;
+		for (int i = 0; i < load->pthreads; i++)
+			pthread_join(pthreads[i], NULL);
+	}
+
+	return sink == 0;
+}
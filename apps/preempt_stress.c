@@ -0,0 +1,135 @@
+/*
+ * Preemption stress test
+ *
+ * Runs CPU-bound threads that never yield with 20 us time slices, many times
+ * over, alternating between CLOCK_PROCESS_CPUTIME_ID and CLOCK_MONOTONIC. The
+ * threads keep creating short-lived threads while being preempted, and two
+ * ordinary pthreads spin next to the scheduler, making the process CPU clock
+ * run faster than the scheduler's kernel thread: alarms come in faster than
+ * the signal handler can serve them.
+ *
+ * The test fails by crashing, or if some thread did not run to completion or
+ * if no thread was ever preempted.
+ *
+ * Usage: preempt_stress.x [rounds]
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define QUANTUM 20
+#define THREADS 4
+#define PTHREADS 2
+#define ITERATIONS 200000
+#define SPAWN_EVERY 10000
+#define CHILD_ITERATIONS 1000
+
+static long rounds = 200;
+static volatile int last_thread;
+static long preemptions;
+static long finished;
+static uint64_t sink;
+static volatile int background_stop;
+
+static uint64_t work(uint64_t value, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+	}
+	return value;
+}
+
+static void child(void *arg)
+{
+	sink += work((long)arg, CHILD_ITERATIONS);
+}
+
+static void spin(void *arg)
+{
+	int id = (long)arg;
+	uint64_t value = id;
+
+	for (long i = 0; i < ITERATIONS; i++) {
+		value = work(value, 1);
+		/* Some other thread ran since our last iteration */
+		if (last_thread != id) {
+			last_thread = id;
+			preemptions++;
+		}
+		if (i % SPAWN_EVERY == 0)
+			uthread_create(child, (void *)i);
+	}
+	sink += value;
+	finished++;
+}
+
+static void start(void *arg)
+{
+	(void)arg;
+
+	for (long i = 1; i <= THREADS; i++)
+		uthread_create(spin, (void *)i);
+}
+
+/* Ordinary pthread of the process, busy next to the scheduler */
+static void *background(void *arg)
+{
+	(void)arg;
+
+	while (!background_stop) {
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t pthreads[PTHREADS];
+
+	if (argc > 1)
+		rounds = atol(argv[1]);
+	if (rounds <= 0)
+		return 1;
+
+	for (int i = 0; i < PTHREADS; i++)
+		pthread_create(&pthreads[i], NULL, background, NULL);
+
+	for (long r = 0; r < rounds; r++) {
+		uthread_run_attr_t attr;
+
+		uthread_run_attr_init(&attr);
+		attr.preempt = true;
+		attr.clock = r % 2 ? CLOCK_MONOTONIC : CLOCK_PROCESS_CPUTIME_ID;
+		attr.quantum = QUANTUM;
+
+		last_thread = 0;
+		finished = 0;
+		if (uthread_run_ex(&attr, start, NULL)) {
+			fprintf(stderr, "preempt_stress: run failed\n");
+			return 1;
+		}
+		if (finished != THREADS) {
+			fprintf(stderr, "preempt_stress: %ld threads of %d "
+				"finished\n", finished, THREADS);
+			return 1;
+		}
+	}
+
+	background_stop = 1;
+	for (int i = 0; i < PTHREADS; i++)
+		pthread_join(pthreads[i], NULL);
+
+	if (preemptions <= rounds * THREADS) {
+		fprintf(stderr, "preempt_stress: no thread was preempted\n");
+		return 1;
+	}
+	printf("preempt_stress: %ld rounds, %ld switches\n", rounds,
+	       preemptions);
+	return sink == 0;
+}
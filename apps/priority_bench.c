@@ -0,0 +1,238 @@
+/*
+ * Priority scheduling latency benchmark
+ *
+ * Measures how long an interactive request takes to be served while CPU-bound
+ * batch threads keep the worker busy. A client thread waits for requests to
+ * arrive at a fixed interval, as noticed by the batch threads between chunks
+ * of work, like a poller would. It then hands each request to a server thread
+ * and waits for its response. The latency of a request goes from its arrival
+ * to the client getting the response, and includes every time the client and
+ * server wait in the ready queue behind the batch threads.
+ *
+ * The run is done in five modes, with preemption:
+ * - fifo: every thread has the default priority, in plain round-robin
+ * - priority: the client and server have a higher priority than the batch
+ * - mlfq: every thread has the default priority, with uthread_policy_mlfq
+ * - raised: the client and server are created with the default priority, and
+ *   raise it with uthread_set_priority() once running
+ * - lowered: the client and server are created with a higher priority, and
+ *   lower it back to the default with uthread_set_priority() once running
+ *
+ * The median latency of the raised mode is checked to be lower than the one of
+ * the fifo mode, and the median latency of the lowered mode to be higher than
+ * the one of the priority mode. The results are printed as CSV, one line per
+ * mode:
+ * mode,requests,p50_us,p99_us,p999_us,max_us,batch_chunks_per_ms
+ *
+ * Usage: priority_bench.x [requests] [quantum in microseconds]
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define BATCH 4
+#define CHUNK 1000
+#define INTERVAL 500000
+#define SERVICE 200
+
+enum mode {
+	MODE_FIFO,
+	MODE_PRIORITY,
+	MODE_MLFQ,
+	MODE_RAISED,
+	MODE_LOWERED,
+};
+
+static const char *mode_names[] = {
+	"fifo", "priority", "mlfq", "raised", "lowered",
+};
+
+static long requests = 1000;
+static long quantum = 500;
+static enum mode mode;
+
+static sem_t arrival, request, response;
+static atomic_int pending;
+static volatile int64_t due;
+static volatile int done;
+static int64_t *latencies;
+static long chunks;
+static uint64_t sink;
+static volatile int failed;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Move the client or server to its priority for the mode, once running */
+static void set_priority(void)
+{
+	if (mode == MODE_RAISED && uthread_set_priority(0))
+		failed = 1;
+	else if (mode == MODE_LOWERED
+		 && uthread_set_priority(UTHREAD_PRIORITY_DEFAULT))
+		failed = 1;
+}
+
+static uint64_t work(uint64_t value, int rounds)
+{
+	for (int i = 0; i < rounds; i++) {
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+	}
+	return value;
+}
+
+/* CPU-bound thread, also noticing the arrival of requests */
+static void batch(void *arg)
+{
+	uint64_t value = (long)arg;
+
+	while (!done) {
+		value = work(value, CHUNK);
+		chunks++;
+		if (atomic_load(&pending) && now() >= due
+		    && atomic_exchange(&pending, 0))
+			sem_up(arrival);
+	}
+	sink += value;
+}
+
+static void server(void *arg)
+{
+	uint64_t value = 1;
+	(void)arg;
+
+	set_priority();
+	while (1) {
+		sem_down(request);
+		if (done)
+			break;
+		value = work(value, SERVICE);
+		sem_up(response);
+	}
+	sink += value;
+}
+
+static void client(void *arg)
+{
+	(void)arg;
+
+	set_priority();
+	for (long i = 0; i < requests; i++) {
+		/* Wait for the next request to arrive */
+		due = now() + INTERVAL;
+		atomic_store(&pending, 1);
+		sem_down(arrival);
+
+		sem_up(request);
+		sem_down(response);
+		latencies[i] = now() - due;
+	}
+
+	done = 1;
+	sem_up(request);
+}
+
+static void start(void *arg)
+{
+	uthread_attr_t attr;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	if (mode == MODE_PRIORITY || mode == MODE_LOWERED)
+		uthread_attr_setpriority(&attr, 0);
+	uthread_create_ex(&attr, server, NULL);
+	uthread_create_ex(&attr, client, NULL);
+	for (long i = 1; i <= BATCH; i++)
+		uthread_create(batch, (void *)i);
+}
+
+static int compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(double p)
+{
+	long i = (long)(p * requests);
+
+	return latencies[i < requests ? i : requests - 1] / 1e3;
+}
+
+int main(int argc, char **argv)
+{
+	double medians[MODE_LOWERED + 1];
+
+	if (argc > 1)
+		requests = atol(argv[1]);
+	if (argc > 2)
+		quantum = atol(argv[2]);
+	if (requests <= 0)
+		return 1;
+
+	latencies = malloc(requests * sizeof(*latencies));
+	arrival = sem_create(0);
+	request = sem_create(0);
+	response = sem_create(0);
+
+	printf("mode,requests,p50_us,p99_us,p999_us,max_us,batch_chunks_per_ms\n");
+	for (mode = MODE_FIFO; mode <= MODE_LOWERED; mode++) {
+		uthread_run_attr_t attr;
+		int64_t begin, end;
+
+		uthread_run_attr_init(&attr);
+		attr.preempt = true;
+		attr.clock = CLOCK_MONOTONIC;
+		attr.quantum = quantum;
+		if (mode == MODE_MLFQ)
+			attr.policy = &uthread_policy_mlfq;
+
+		done = 0;
+		chunks = 0;
+		begin = now();
+		if (uthread_run_ex(&attr, start, NULL)) {
+			fprintf(stderr, "priority_bench: run failed\n");
+			return 1;
+		}
+		end = now();
+		if (failed) {
+			fprintf(stderr, "priority_bench: setting priority "
+				"failed\n");
+			return 1;
+		}
+
+		qsort(latencies, requests, sizeof(*latencies), compare);
+		medians[mode] = percentile(0.5);
+		printf("%s,%ld,%.1f,%.1f,%.1f,%.1f,%.1f\n", mode_names[mode],
+		       requests, percentile(0.5), percentile(0.99),
+		       percentile(0.999), latencies[requests - 1] / 1e3,
+		       chunks * 1e6 / (end - begin));
+	}
+
+	if (medians[MODE_RAISED] >= medians[MODE_FIFO]
+	    || medians[MODE_LOWERED] <= medians[MODE_PRIORITY]) {
+		fprintf(stderr, "priority_bench: latencies do not follow "
+			"uthread_set_priority()\n");
+		return 1;
+	}
+
+	sem_destroy(arrival);
+	sem_destroy(request);
+	sem_destroy(response);
+	free(latencies);
+	return sink == 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * Queue microbenchmark
+ *
+ * Measures the cost of the queue operations for the linked-list queue
+ * (queue.h), the intrusive queue (iqueue_t) and the ring-buffer queue
+ * (rqueue.h), for queue sizes from 10 up to 10^7 items:
+ * - enqueue and dequeue throughput, filling then draining the queue
+ * - queue_delete at the head, middle and tail of the queue; each deleted item
+ *   is enqueued back so that the queue keeps its size, and that enqueue is
+ *   part of the measured operation
+ * - queue_iterate over the whole queue, reported per visited item
+ *
+ * Each operation is repeated until about 10^7 items were processed (at least
+ * once), and reported as one CSV line on stdout:
+ *	impl,op,size,ops,ns_per_op,allocs_per_op
+ * where allocs_per_op counts calls to malloc() made by the queue library.
+ *
+ * Usage: queue_bench.x [max size]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <queue.h>
+#include <rqueue.h>
+
+#define WORK 10000000L
+
+/* Count the allocations made through malloc() (glibc) */
+extern void *__libc_malloc(size_t size);
+static long allocs;
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+struct item {
+	long value;
+	queue_link_t link;
+};
+
+static struct item *items;
+static long visited;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *impl, const char *op, long size, long ops,
+		   double ns, long op_allocs)
+{
+	printf("%s,%s,%ld,%ld,%.2f,%.3f\n", impl, op, size, ops, ns / ops,
+	       (double)op_allocs / ops);
+	fflush(stdout);
+}
+
+/* Number of repetitions for an operation touching @cost items */
+static long reps_for(long cost)
+{
+	long reps = WORK / cost;
+
+	return reps > 0 ? reps : 1;
+}
+
+/* Item at position @pos after @k delete/re-enqueue rounds at that position */
+static long rotated(long size, long pos, long k)
+{
+	return pos + k % (size - pos);
+}
+
+static void count_list(queue_t q, void *data)
+{
+	(void)q;
+	(void)data;
+	visited++;
+}
+
+static void count_ring(rqueue_t q, void *data)
+{
+	(void)q;
+	(void)data;
+	visited++;
+}
+
+static void count_intrusive(iqueue_t *q, queue_link_t *link)
+{
+	(void)q;
+	(void)link;
+	visited++;
+}
+
+static void bench_list(long size)
+{
+	long reps, a;
+	double t;
+	void *data;
+	queue_t q = queue_create();
+
+	reps = reps_for(size);
+	a = allocs;
+	t = now_ns();
+	for (long r = 0; r < reps; r++) {
+		for (long i = 0; i < size; i++)
+			queue_enqueue(q, &items[i]);
+		while (queue_dequeue(q, &data) == 0);
+	}
+	t = now_ns() - t;
+	report("list", "enqueue_dequeue", size, 2 * size * reps, t, allocs - a);
+
+	for (long i = 0; i < size; i++)
+		queue_enqueue(q, &items[i]);
+
+	const char *names[] = { "delete_head", "delete_middle", "delete_tail" };
+	long positions[] = { 0, size / 2, size - 1 };
+	for (int p = 0; p < 3; p++) {
+		reps = reps_for(positions[p] + 1);
+		if (reps > 100000)
+			reps = 100000;
+		a = allocs;
+		t = now_ns();
+		for (long k = 0; k < reps; k++) {
+			long i = rotated(size, positions[p], k);
+			queue_delete(q, &items[i]);
+			queue_enqueue(q, &items[i]);
+		}
+		t = now_ns() - t;
+		report("list", names[p], size, reps, t, allocs - a);
+
+		/* Restore the original order */
+		while (queue_dequeue(q, &data) == 0);
+		for (long i = 0; i < size; i++)
+			queue_enqueue(q, &items[i]);
+	}
+
+	reps = reps_for(size);
+	visited = 0;
+	a = allocs;
+	t = now_ns();
+	for (long r = 0; r < reps; r++)
+		queue_iterate(q, count_list);
+	t = now_ns() - t;
+	report("list", "iterate", size, visited, t, allocs - a);
+
+	while (queue_dequeue(q, &data) == 0);
+	queue_destroy(q);
+}
+
+static void bench_ring(long size)
+{
+	long reps, a;
+	double t;
+	void *data;
+	rqueue_t q = rqueue_create();
+
+	reps = reps_for(size);
+	a = allocs;
+	t = now_ns();
+	for (long r = 0; r < reps; r++) {
+		for (long i = 0; i < size; i++)
+			rqueue_enqueue(q, &items[i]);
+		while (rqueue_dequeue(q, &data) == 0);
+	}
+	t = now_ns() - t;
+	report("ring", "enqueue_dequeue", size, 2 * size * reps, t, allocs - a);
+
+	for (long i = 0; i < size; i++)
+		rqueue_enqueue(q, &items[i]);
+
+	const char *names[] = { "delete_head", "delete_middle", "delete_tail" };
+	long positions[] = { 0, size / 2, size - 1 };
+	for (int p = 0; p < 3; p++) {
+		reps = reps_for(positions[p] + 1);
+		if (reps > 100000)
+			reps = 100000;
+		a = allocs;
+		t = now_ns();
+		for (long k = 0; k < reps; k++) {
+			long i = rotated(size, positions[p], k);
+			rqueue_delete(q, &items[i]);
+			rqueue_enqueue(q, &items[i]);
+		}
+		t = now_ns() - t;
+		report("ring", names[p], size, reps, t, allocs - a);
+
+		while (rqueue_dequeue(q, &data) == 0);
+		for (long i = 0; i < size; i++)
+			rqueue_enqueue(q, &items[i]);
+	}
+
+	reps = reps_for(size);
+	visited = 0;
+	a = allocs;
+	t = now_ns();
+	for (long r = 0; r < reps; r++)
+		rqueue_iterate(q, count_ring);
+	t = now_ns() - t;
+	report("ring", "iterate", size, visited, t, allocs - a);
+
+	while (rqueue_dequeue(q, &data) == 0);
+	rqueue_destroy(q);
+}
+
+static void bench_intrusive(long size)
+{
+	long reps, a;
+	double t;
+	queue_link_t *link;
+	iqueue_t q;
+
+	iqueue_init(&q);
+	reps = reps_for(size);
+	a = allocs;
+	t = now_ns();
+	for (long r = 0; r < reps; r++) {
+		for (long i = 0; i < size; i++)
+			iqueue_enqueue(&q, &items[i].link);
+		while (iqueue_dequeue(&q, &link) == 0);
+	}
+	t = now_ns() - t;
+	report("intrusive", "enqueue_dequeue", size, 2 * size * reps, t,
+	       allocs - a);
+
+	for (long i = 0; i < size; i++)
+		iqueue_enqueue(&q, &items[i].link);
+
+	/* Searching delete, comparable to the other queues */
+	const char *names[] = { "delete_head", "delete_middle", "delete_tail" };
+	long positions[] = { 0, size / 2, size - 1 };
+	for (int p = 0; p < 3; p++) {
+		reps = reps_for(positions[p] + 1);
+		if (reps > 100000)
+			reps = 100000;
+		a = allocs;
+		t = now_ns();
+		for (long k = 0; k < reps; k++) {
+			long i = rotated(size, positions[p], k);
+			iqueue_delete(&q, &items[i].link);
+			iqueue_enqueue(&q, &items[i].link);
+		}
+		t = now_ns() - t;
+		report("intrusive", names[p], size, reps, t, allocs - a);
+
+		while (iqueue_dequeue(&q, &link) == 0);
+		for (long i = 0; i < size; i++)
+			iqueue_enqueue(&q, &items[i].link);
+	}
+
+	reps = reps_for(size);
+	visited = 0;
+	a = allocs;
+	t = now_ns();
+	for (long r = 0; r < reps; r++)
+		iqueue_iterate(&q, count_intrusive);
+	t = now_ns() - t;
+	report("intrusive", "iterate", size, visited, t, allocs - a);
+
+	while (iqueue_dequeue(&q, &link) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	long max_size = 10000000L;
+
+	if (argc > 1)
+		max_size = atol(argv[1]);
+
+	items = calloc(max_size, sizeof(struct item));
+	if (items == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	printf("impl,op,size,ops,ns_per_op,allocs_per_op\n");
+	for (long size = 10; size <= max_size; size *= 10) {
+		bench_list(size);
+		bench_intrusive(size);
+		bench_ring(size);
+	}
+
+	free(items);
+	return 0;
+}
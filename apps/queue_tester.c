@@ -2,7 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <heap.h>
 #include <queue.h>
+#include <rqueue.h>
 
 // Tester
 // ============================================================================
@@ -300,6 +302,311 @@ void test_iterator(void) {
     free_queue(q_blank);
 }
 
+/* Test splice and batch operations */
+void test_splice_batch(void) {
+    int data[6] = {0, 1, 2, 3, 4, 5};
+    void *items[6] = {&data[0], &data[1], &data[2], &data[3], &data[4], &data[5]};
+    void *out[8];
+    int *ptr;
+    queue_t q1 = queue_create();
+    queue_t q2 = queue_create();
+
+    // Invalid arguments
+    TEST_ASSERT(queue_splice(NULL, q2) == -1);
+    TEST_ASSERT(queue_splice(q1, q1) == -1);
+    TEST_ASSERT(queue_enqueue_n(NULL, items, 2) == -1);
+    TEST_ASSERT(queue_enqueue_n(q1, items, -1) == -1);
+    TEST_ASSERT(queue_dequeue_n(q1, NULL, 2) == -1);
+
+    // Batch with a NULL item enqueues nothing
+    items[2] = NULL;
+    TEST_ASSERT(queue_enqueue_n(q1, items, 3) == -1);
+    TEST_ASSERT(queue_length(q1) == 0);
+    items[2] = &data[2];
+
+    // Batch enqueue into an empty queue and a non-empty one
+    TEST_ASSERT(queue_enqueue_n(q1, items, 3) == 0);
+    TEST_ASSERT(queue_enqueue_n(q2, items + 3, 3) == 0);
+    TEST_ASSERT(queue_length(q1) == 3);
+
+    // Splice an empty queue, then q2 at the end of q1
+    queue_t empty = queue_create();
+    TEST_ASSERT(queue_splice(q1, empty) == 0);
+    TEST_ASSERT(queue_splice(q1, q2) == 0);
+    TEST_ASSERT(queue_length(q1) == 6);
+    TEST_ASSERT(queue_length(q2) == 0);
+
+    // Batch dequeue keeps order, and stops when the queue runs out
+    TEST_ASSERT(queue_dequeue_n(q1, out, 4) == 4);
+    TEST_ASSERT(out[0] == &data[0] && out[3] == &data[3]);
+    TEST_ASSERT(queue_dequeue_n(q1, out, 8) == 2);
+    TEST_ASSERT(out[1] == &data[5]);
+
+    // Splice into a dequeue-emptied queue, then reuse the source
+    queue_enqueue(q2, &data[1]);
+    TEST_ASSERT(queue_splice(q1, q2) == 0);
+    queue_enqueue(q2, &data[2]);
+    TEST_ASSERT(queue_splice(q1, q2) == 0);
+    queue_dequeue(q1, (void**)&ptr);
+    TEST_ASSERT(ptr == &data[1]);
+    queue_dequeue(q1, (void**)&ptr);
+    TEST_ASSERT(ptr == &data[2]);
+    TEST_ASSERT(queue_length(q1) == 0);
+
+    free_queue(q1);
+    free_queue(q2);
+    free_queue(empty);
+}
+
+/* Item embedding an intrusive link */
+struct item {
+    int value;
+    queue_link_t link;
+};
+
+/* Delete odd items of an intrusive queue */
+static void delete_odd(iqueue_t *q, queue_link_t *link) {
+    struct item *it = iqueue_entry(link, struct item, link);
+    if (it->value & 1) {
+        iqueue_delete(q, link);
+    }
+}
+
+/* Test the intrusive queue */
+void test_intrusive(void) {
+    struct item items[10];
+    struct item other;
+    queue_link_t *link;
+    iqueue_t q;
+
+    // Uninitialized queue / link
+    TEST_ASSERT(iqueue_init(NULL) == -1);
+    TEST_ASSERT(iqueue_enqueue(NULL, &other.link) == -1);
+    TEST_ASSERT(iqueue_dequeue(NULL, &link) == -1);
+    TEST_ASSERT(iqueue_length(NULL) == -1);
+    iqueue_init(&q);
+    TEST_ASSERT(iqueue_enqueue(&q, NULL) == -1);
+    TEST_ASSERT(iqueue_dequeue(&q, NULL) == -1);
+    TEST_ASSERT(iqueue_iterate(&q, NULL) == -1);
+
+    // Dequeue from an empty queue
+    TEST_ASSERT(iqueue_dequeue(&q, &link) == -1);
+
+    // Enqueue / dequeue order
+    for (int i = 0; i < 10; i++) {
+        items[i].value = i;
+        iqueue_enqueue(&q, &items[i].link);
+    }
+    TEST_ASSERT(iqueue_length(&q) == 10);
+    iqueue_dequeue(&q, &link);
+    TEST_ASSERT(iqueue_entry(link, struct item, link) == &items[0]);
+
+    // Delete a link that is not in the queue
+    TEST_ASSERT(iqueue_delete(&q, &other.link) == -1);
+
+    // Delete tail and a middle link
+    TEST_ASSERT(iqueue_delete(&q, &items[9].link) == 0);
+    TEST_ASSERT(iqueue_delete(&q, &items[4].link) == 0);
+    TEST_ASSERT(iqueue_length(&q) == 7);
+
+    // Delete while iterating: 2, 6, 8 remain
+    iqueue_iterate(&q, delete_odd);
+    TEST_ASSERT(iqueue_length(&q) == 3);
+    iqueue_dequeue(&q, &link);
+    TEST_ASSERT(iqueue_entry(link, struct item, link)->value == 2);
+    iqueue_dequeue(&q, &link);
+    iqueue_dequeue(&q, &link);
+    TEST_ASSERT(iqueue_entry(link, struct item, link)->value == 8);
+    TEST_ASSERT(iqueue_length(&q) == 0);
+
+    // Reuse a dequeue-emptied queue
+    TEST_ASSERT(iqueue_enqueue(&q, &items[1].link) == 0);
+    TEST_ASSERT(iqueue_delete(&q, &items[1].link) == 0);
+    TEST_ASSERT(iqueue_length(&q) == 0);
+
+    // Splice two queues
+    iqueue_t q2;
+    iqueue_init(&q2);
+    TEST_ASSERT(iqueue_splice(&q, &q) == -1);
+    iqueue_enqueue(&q, &items[1].link);
+    iqueue_enqueue(&q2, &items[2].link);
+    iqueue_enqueue(&q2, &items[3].link);
+    TEST_ASSERT(iqueue_splice(&q, &q2) == 0);
+    TEST_ASSERT(iqueue_length(&q) == 3 && iqueue_length(&q2) == 0);
+    TEST_ASSERT(iqueue_remove(&q, &items[3].link) == 0);
+    iqueue_dequeue(&q, &link);
+    iqueue_dequeue(&q, &link);
+    TEST_ASSERT(iqueue_entry(link, struct item, link) == &items[2]);
+    TEST_ASSERT(iqueue_length(&q) == 0);
+
+    // Enqueue at the head
+    TEST_ASSERT(iqueue_enqueue_head(NULL, &items[1].link) == -1);
+    TEST_ASSERT(iqueue_enqueue_head(&q, NULL) == -1);
+    TEST_ASSERT(iqueue_enqueue_head(&q, &items[1].link) == 0);
+    iqueue_enqueue(&q, &items[2].link);
+    TEST_ASSERT(iqueue_enqueue_head(&q, &items[3].link) == 0);
+    TEST_ASSERT(iqueue_length(&q) == 3);
+    iqueue_dequeue(&q, &link);
+    TEST_ASSERT(iqueue_entry(link, struct item, link) == &items[3]);
+    TEST_ASSERT(iqueue_remove(&q, &items[2].link) == 0);
+    TEST_ASSERT(q.head == &items[1].link && q.tail == &items[1].link);
+    iqueue_dequeue(&q, &link);
+    TEST_ASSERT(iqueue_length(&q) == 0);
+}
+
+/* Delete the current and the next ring item whenever the current one is 3 */
+static void delete_three_and_next(rqueue_t q, void *data) {
+    int *a = (int*)data;
+    if (*a == 3) {
+        rqueue_delete(q, a);
+        rqueue_delete(q, a + 1);
+    }
+}
+
+/* Add 10 to ring items */
+static void increment_ring(rqueue_t q, void *data) {
+    (void)q;
+    *(int*)data += 10;
+}
+
+/* Test the ring-buffer queue */
+void test_ring(void) {
+    int data[100], *ptr;
+    rqueue_t q = NULL;
+
+    // Uninitialized queue / data
+    TEST_ASSERT(rqueue_enqueue(q, &data[0]) == -1);
+    TEST_ASSERT(rqueue_dequeue(q, (void**)&ptr) == -1);
+    TEST_ASSERT(rqueue_peek(q, (void**)&ptr) == -1);
+    TEST_ASSERT(rqueue_delete(q, &data[0]) == -1);
+    TEST_ASSERT(rqueue_iterate(q, increment_ring) == -1);
+    TEST_ASSERT(rqueue_length(q) == -1);
+    TEST_ASSERT(rqueue_destroy(q) == -1);
+    q = rqueue_create();
+    TEST_ASSERT(q != NULL);
+    TEST_ASSERT(rqueue_enqueue(q, NULL) == -1);
+    TEST_ASSERT(rqueue_dequeue(q, NULL) == -1);
+    TEST_ASSERT(rqueue_dequeue(q, (void**)&ptr) == -1);
+    TEST_ASSERT(rqueue_peek(q, (void**)&ptr) == -1);
+
+    // Wrap around the ring and grow it while wrapped
+    for (int i = 0; i < 100; i++) {
+        data[i] = i;
+    }
+    for (int i = 0; i < 10; i++) {
+        rqueue_enqueue(q, &data[i]);
+    }
+    for (int i = 0; i < 8; i++) {
+        rqueue_dequeue(q, (void**)&ptr);
+    }
+    for (int i = 10; i < 100; i++) {
+        rqueue_enqueue(q, &data[i]);
+    }
+    TEST_ASSERT(rqueue_length(q) == 92);
+    TEST_ASSERT(rqueue_peek(q, (void**)&ptr) == 0);
+    TEST_ASSERT(ptr == &data[8] && rqueue_length(q) == 92);
+    rqueue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data[8]);
+
+    // Non-empty queue cannot be destroyed
+    TEST_ASSERT(rqueue_destroy(q) == -1);
+
+    // Delete near the head, near the tail, and a missing item
+    TEST_ASSERT(rqueue_delete(q, &data[10]) == 0);
+    TEST_ASSERT(rqueue_delete(q, &data[98]) == 0);
+    TEST_ASSERT(rqueue_delete(q, &data[0]) == -1);
+    TEST_ASSERT(rqueue_length(q) == 89);
+    rqueue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data[9]);
+    rqueue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data[11]);
+    while (!rqueue_dequeue(q, (void**)&ptr));
+    TEST_ASSERT(ptr == &data[99]);
+
+    // Delete the current and next items while iterating
+    for (int i = 0; i < 6; i++) {
+        rqueue_enqueue(q, &data[i]);
+    }
+    rqueue_iterate(q, delete_three_and_next);
+    TEST_ASSERT(rqueue_length(q) == 4);
+    rqueue_iterate(q, increment_ring);
+    TEST_ASSERT(data[2] == 12 && data[3] == 3 && data[4] == 4);
+    TEST_ASSERT(data[5] == 15);
+
+    while (!rqueue_dequeue(q, (void**)&ptr));
+    TEST_ASSERT(rqueue_destroy(q) == 0);
+}
+
+/* Item embedding an intrusive heap link */
+struct heap_item {
+    int value;
+    heap_link_t link;
+};
+
+/* Order heap items by increasing value */
+static int heap_item_cmp(const heap_link_t *a, const heap_link_t *b) {
+    return iheap_entry(a, struct heap_item, link)->value
+        - iheap_entry(b, struct heap_item, link)->value;
+}
+
+/* Test the intrusive heap */
+void test_heap(void) {
+    struct heap_item items[100];
+    heap_link_t *link;
+    iheap_t h;
+
+    // Uninitialized heap / link / ordering
+    TEST_ASSERT(iheap_init(NULL, heap_item_cmp) == -1);
+    TEST_ASSERT(iheap_init(&h, NULL) == -1);
+    TEST_ASSERT(iheap_insert(NULL, &items[0].link) == -1);
+    TEST_ASSERT(iheap_pop(NULL, &link) == -1);
+    TEST_ASSERT(iheap_length(NULL) == -1);
+    iheap_init(&h, heap_item_cmp);
+    TEST_ASSERT(iheap_insert(&h, NULL) == -1);
+    TEST_ASSERT(iheap_pop(&h, NULL) == -1);
+    TEST_ASSERT(iheap_remove(&h, NULL) == -1);
+
+    // Pop and peek an empty heap
+    TEST_ASSERT(iheap_pop(&h, &link) == -1);
+    TEST_ASSERT(iheap_peek(&h, &link) == -1);
+
+    // Insert in scrambled order, smallest first out
+    for (int i = 0; i < 100; i++) {
+        items[i].value = (i * 37) % 100;
+        iheap_insert(&h, &items[i].link);
+    }
+    TEST_ASSERT(iheap_length(&h) == 100);
+    TEST_ASSERT(iheap_peek(&h, &link) == 0);
+    TEST_ASSERT(iheap_entry(link, struct heap_item, link)->value == 0);
+    TEST_ASSERT(iheap_length(&h) == 100);
+    iheap_pop(&h, &link);
+    TEST_ASSERT(iheap_entry(link, struct heap_item, link)->value == 0);
+
+    // Remove the root, a leaf and inner links: 10, 20, ..., 90 and 1
+    TEST_ASSERT(iheap_remove(&h, &items[73].link) == 0);
+    for (int i = 0; i < 100; i++) {
+        if (items[i].value % 10 == 0 && items[i].value != 0) {
+            TEST_ASSERT(iheap_remove(&h, &items[i].link) == 0);
+        }
+    }
+    TEST_ASSERT(iheap_length(&h) == 89);
+
+    // The rest still comes out in order
+    int last = -1, sorted = 1;
+    while (!iheap_pop(&h, &link)) {
+        int value = iheap_entry(link, struct heap_item, link)->value;
+        sorted &= value > last && value % 10 != 0 && value != 1;
+        last = value;
+    }
+    TEST_ASSERT(sorted && last == 99);
+    TEST_ASSERT(iheap_length(&h) == 0);
+
+    // Reuse a pop-emptied heap
+    TEST_ASSERT(iheap_insert(&h, &items[5].link) == 0);
+    TEST_ASSERT(iheap_remove(&h, &items[5].link) == 0);
+    TEST_ASSERT(iheap_length(&h) == 0);
+}
+
 // Run each test
 int main(void) {
     fprintf(stderr, "*** Running queue test ***\n");
@@ -328,6 +635,18 @@ int main(void) {
     fprintf(stderr, "*** TEST iterator ***\n");
     test_iterator();
 
+    fprintf(stderr, "*** TEST splice / batch ***\n");
+    test_splice_batch();
+
+    fprintf(stderr, "*** TEST intrusive queue ***\n");
+    test_intrusive();
+
+    fprintf(stderr, "*** TEST ring queue ***\n");
+    test_ring();
+
+    fprintf(stderr, "*** TEST intrusive heap ***\n");
+    test_heap();
+
     fprintf(stderr, "*** All test passed ***\n");
     return 0;
 }
@@ -0,0 +1,191 @@
+/*
+ * Reader-writer lock benchmark
+ *
+ * Threads access a shared table a fixed number of times each, guarded either
+ * by a semaphore of count 1 or by a reader-writer lock. One access in
+ * WRITE_EVERY fills the table with a new value, the others read it back whole
+ * and check that all its entries match. The cost of an access covers locking,
+ * the access and unlocking.
+ *
+ * The run is done once per lock and per case:
+ * - cooperative: threads without preemption, on a single worker, yielding in
+ *   the middle of their accesses now and then, so that readers overlap
+ * - preempted: threads preempted with 100 us slices of CLOCK_MONOTONIC, on a
+ *   single worker
+ * - parallel: the same on 4 workers, where readers may also read the table at
+ *   the same time from different kernel threads
+ *
+ * The number of writes is checked against its expected value. The results are
+ * printed as CSV, one line per lock and case:
+ * lock,case,workers,threads,ns_per_access
+ *
+ * Usage: rwlock_bench.x [accesses per thread] [threads]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <rwlock.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define QUANTUM 100
+#define TABLE 64
+#define WRITE_EVERY 20
+#define YIELD_EVERY 8
+
+struct bench_case {
+	const char *name;
+	int workers;
+	bool preempt;
+};
+
+static const struct bench_case cases[] = {
+	{ "cooperative", 1, false },
+	{ "preempted", 1, true },
+	{ "parallel", 4, true },
+};
+
+#define CASES (int)(sizeof(cases) / sizeof(cases[0]))
+
+static long accesses = 200000;
+static long threads = 8;
+
+static bool use_rwlock;
+static bool cooperative;
+static sem_t sem;
+static uthread_rwlock_t rwlock;
+static volatile long table[TABLE];
+static volatile long writes;
+static volatile bool torn;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void lock(bool write)
+{
+	if (!use_rwlock)
+		sem_down(sem);
+	else if (write)
+		uthread_rwlock_wrlock(rwlock);
+	else
+		uthread_rwlock_rdlock(rwlock);
+}
+
+static void unlock(void)
+{
+	if (use_rwlock)
+		uthread_rwlock_unlock(rwlock);
+	else
+		sem_up(sem);
+}
+
+static void accessor(void *arg)
+{
+	long id = (long)arg;
+
+	for (long i = 0; i < accesses; i++) {
+		bool write = (i + id) % WRITE_EVERY == 0;
+		bool yield = cooperative && (i + id) % YIELD_EVERY == 0;
+
+		lock(write);
+		if (write) {
+			long value = writes + 1;
+
+			for (int e = 0; e < TABLE / 2; e++)
+				table[e] = value;
+			if (yield)
+				uthread_yield();
+			for (int e = TABLE / 2; e < TABLE; e++)
+				table[e] = value;
+			writes = value;
+		} else {
+			long value = table[0];
+
+			if (yield)
+				uthread_yield();
+			for (int e = 1; e < TABLE; e++) {
+				if (table[e] != value)
+					torn = true;
+			}
+		}
+		unlock();
+	}
+}
+
+static void start(void *arg)
+{
+	long n = (long)arg;
+
+	for (long i = 0; i < n; i++)
+		uthread_create(accessor, (void *)i);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		accesses = atol(argv[1]);
+	if (argc > 2)
+		threads = atol(argv[2]);
+	if (accesses <= 0 || threads <= 0)
+		return 1;
+
+	long expected = 0;
+
+	for (long id = 0; id < threads; id++) {
+		for (long i = 0; i < accesses; i++)
+			expected += (i + id) % WRITE_EVERY == 0;
+	}
+
+	printf("lock,case,workers,threads,ns_per_access\n");
+	for (int l = 0; l < 2; l++) {
+		use_rwlock = l == 1;
+		for (int c = 0; c < CASES; c++) {
+			uthread_run_attr_t attr;
+			int64_t begin, elapsed;
+
+			uthread_run_attr_init(&attr);
+			attr.workers = cases[c].workers;
+			attr.preempt = cases[c].preempt;
+			attr.clock = CLOCK_MONOTONIC;
+			attr.quantum = QUANTUM;
+			cooperative = !cases[c].preempt;
+
+			sem = sem_create(1);
+			rwlock = uthread_rwlock_create();
+			for (int e = 0; e < TABLE; e++)
+				table[e] = 0;
+			writes = 0;
+			torn = false;
+			begin = now();
+			if (uthread_run_ex(&attr, start, (void *)threads)) {
+				fprintf(stderr, "rwlock_bench: run failed\n");
+				return 1;
+			}
+			elapsed = now() - begin;
+			if (writes != expected || torn) {
+				fprintf(stderr, "rwlock_bench: %ld writes, expected "
+					"%ld%s\n", writes, expected,
+					torn ? ", torn reads" : "");
+				return 1;
+			}
+			if (sem_destroy(sem) || uthread_rwlock_destroy(rwlock)) {
+				fprintf(stderr, "rwlock_bench: destroy failed\n");
+				return 1;
+			}
+
+			printf("%s,%s,%d,%ld,%.1f\n",
+			       use_rwlock ? "rwlock" : "sem", cases[c].name,
+			       cases[c].workers, threads,
+			       (double)elapsed / (threads * accesses));
+		}
+	}
+	return 0;
+}
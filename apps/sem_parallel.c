@@ -0,0 +1,179 @@
+/*
+ * Parallel pipeline test
+ *
+ * Runs a CPU-bound pipeline like the one of sem_prime.c, where a source thread
+ * feeds numbers through a chain of stage threads that each hash them before
+ * passing them on, on several workers. Every hop blocks and unblocks threads
+ * that may run on different workers. Meanwhile, counter threads increment a
+ * counter protected by a semaphore, with shared stack threads among them.
+ *
+ * The sum of the hashes reaching the sink and the counter are checked against
+ * their expected values, and the time taken is printed so that runs with
+ * different numbers of workers can be compared.
+ *
+ * Usage: sem_parallel.x [workers] [items] [preempt]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define STAGES 8
+#define ROUNDS 20000
+#define COUNTERS 16
+#define INCREMENTS 2000
+
+struct channel {
+	uint64_t value;
+	int done;
+	sem_t produce;
+	sem_t consume;
+};
+
+static struct channel channels[STAGES + 1];
+static int items = 2000;
+static uint64_t sum;
+
+static sem_t mutex;
+static long counter;
+
+/* CPU-bound work done by each stage on each number */
+static uint64_t hash(uint64_t value)
+{
+	for (int i = 0; i < ROUNDS; i++) {
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+	}
+	return value;
+}
+
+static void send(struct channel *c, uint64_t value, int done)
+{
+	c->value = value;
+	c->done = done;
+	sem_up(c->consume);
+	sem_down(c->produce);
+}
+
+static int receive(struct channel *c, uint64_t *value)
+{
+	int done;
+
+	sem_down(c->consume);
+	*value = c->value;
+	done = c->done;
+	sem_up(c->produce);
+	return done;
+}
+
+static void source(void *arg)
+{
+	(void)arg;
+
+	for (int i = 1; i <= items; i++)
+		send(&channels[0], i, 0);
+	send(&channels[0], 0, 1);
+}
+
+static void stage(void *arg)
+{
+	long id = (long)arg;
+	uint64_t value;
+
+	while (!receive(&channels[id], &value))
+		send(&channels[id + 1], hash(value), 0);
+	send(&channels[id + 1], 0, 1);
+}
+
+static void sink(void *arg)
+{
+	uint64_t value;
+	(void)arg;
+
+	while (!receive(&channels[STAGES], &value))
+		sum += value;
+}
+
+static void count(void *arg)
+{
+	(void)arg;
+
+	for (int i = 0; i < INCREMENTS; i++) {
+		sem_down(mutex);
+		counter++;
+		sem_up(mutex);
+		if (i % 100 == 0)
+			uthread_yield();
+	}
+}
+
+static void spawner(void *arg)
+{
+	uthread_attr_t attr;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	uthread_attr_setsharedstack(&attr, true);
+	for (int i = 0; i < COUNTERS; i++) {
+		if (uthread_create_ex(i % 2 ? &attr : NULL, count, NULL))
+			exit(1);
+	}
+
+	uthread_create(sink, NULL);
+	for (long i = STAGES - 1; i >= 0; i--)
+		uthread_create(stage, (void *)i);
+	uthread_create(source, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	uthread_run_attr_t attr;
+	struct timespec start, end;
+	uint64_t expected = 0;
+
+	uthread_run_attr_init(&attr);
+	if (argc > 1)
+		attr.workers = atoi(argv[1]);
+	if (argc > 2)
+		items = atoi(argv[2]);
+	if (argc > 3)
+		attr.preempt = atoi(argv[3]) > 0;
+
+	for (int i = 0; i <= STAGES; i++) {
+		channels[i].produce = sem_create(0);
+		channels[i].consume = sem_create(0);
+	}
+	mutex = sem_create(1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (uthread_run_ex(&attr, spawner, NULL))
+		return 1;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (int i = 0; i <= STAGES; i++) {
+		sem_destroy(channels[i].produce);
+		sem_destroy(channels[i].consume);
+	}
+	sem_destroy(mutex);
+
+	for (int i = 1; i <= items; i++) {
+		uint64_t value = i;
+
+		for (int j = 0; j < STAGES; j++)
+			value = hash(value);
+		expected += value;
+	}
+
+	printf("%d workers, %d items through %d stages: %.1f ms, sum %s, "
+	       "counter %s\n", attr.workers, items, STAGES,
+	       (end.tv_sec - start.tv_sec) * 1e3
+	       + (end.tv_nsec - start.tv_nsec) / 1e6,
+	       sum == expected ? "ok" : "WRONG",
+	       counter == (long)COUNTERS * INCREMENTS ? "ok" : "WRONG");
+	return sum != expected || counter != (long)COUNTERS * INCREMENTS;
+}
@@ -4,6 +4,7 @@
  * Test preempted interupts by having mutliple threads hog resources until the
  * the 4th thread breaks their loops
  *
+ * Usage: test_preempt.x [preempt] [quantum in microseconds]
  */
 
 #include <stdio.h>
@@ -12,6 +13,7 @@
 #include <uthread.h>
 
 volatile int INFINITE_LOOP = 1;
+long QUANTUM = 0;
 
 void thread4(void *arg) {
     (void)arg;
@@ -42,6 +44,11 @@ void thread2(void *arg) {
 void thread1(void *arg) {
     (void)arg;
 
+    // Change the time slice on the fly if user specifies
+    if (QUANTUM > 0 && uthread_set_quantum(QUANTUM) < 0) {
+        printf("thread1 failed to set quantum\n");
+    }
+
     printf("thread1 entering loops\n");
     uthread_create(thread2, NULL);
     // Stuck here until preempt interrupts loop
@@ -57,6 +64,9 @@ int main(int argc, char **argv) {
             use_preempt = true;
         }
     }
+    if (argc > 2) {
+        QUANTUM = atol(argv[2]);
+    }
 
     uthread_run(use_preempt, thread1, NULL);
     return 0;
@@ -0,0 +1,88 @@
+/*
+ * Unblock scaling benchmark
+ *
+ * Parks a growing population of threads, each blocked on its own semaphore,
+ * then measures the cost of waking them with sem_up(), newest first so that a
+ * wake-up cannot benefit from the thread being near the head of the blocked
+ * set. With constant-time unblocking the cost per wake-up stays flat as the
+ * blocked population grows.
+ *
+ * Threads run on the shared stack to keep memory usage low.
+ *
+ * Usage: unblock_bench.x [max threads]
+ * Output: one CSV line per population: threads,wakes,ns_per_wake
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define WAKES 1000
+
+static long max_threads = 100000;
+static long parked;
+static sem_t *sems;
+
+static void sleeper(void *arg)
+{
+	parked++;
+	sem_down(sems[(long)arg]);
+	parked--;
+}
+
+static void bench(void *arg)
+{
+	struct timespec start, end;
+	uthread_attr_t attr;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	uthread_attr_setsharedstack(&attr, true);
+
+	printf("threads,wakes,ns_per_wake\n");
+	for (long n = 10; n <= max_threads; n *= 10) {
+		long wakes = n < WAKES ? n : WAKES;
+
+		for (long i = 0; i < n; i++) {
+			if (uthread_create_ex(&attr, sleeper, (void *)i))
+				exit(1);
+		}
+		while (parked < n)
+			uthread_yield();
+
+		/* Only time the wake-ups, not running the woken threads */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (long i = n - 1; i >= n - wakes; i--)
+			sem_up(sems[i]);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		for (long i = n - wakes - 1; i >= 0; i--)
+			sem_up(sems[i]);
+		while (parked > 0)
+			uthread_yield();
+
+		double ns = (end.tv_sec - start.tv_sec) * 1e9
+			+ (end.tv_nsec - start.tv_nsec);
+		printf("%ld,%ld,%.1f\n", n, wakes, ns / wakes);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		max_threads = atol(argv[1]);
+
+	sems = malloc(max_threads * sizeof(sem_t));
+	for (long i = 0; i < max_threads; i++)
+		sems[i] = sem_create(0);
+
+	uthread_run(false, bench, NULL);
+
+	for (long i = 0; i < max_threads; i++)
+		sem_destroy(sems[i]);
+	free(sems);
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Thread churn test
+ *
+ * Creates short-lived threads in waves so that exited threads get recycled by
+ * the thread pool, then prints the pool counters. The first wave has to
+ * allocate, every following wave should be served from the pool.
+ *
+ * Usage: uthread_churn.x [waves] [threads per wave]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+static int waves = 100;
+static int width = 8;
+static int done;
+
+static void worker(void *arg)
+{
+	(void)arg;
+
+	done++;
+}
+
+static void spawner(void *arg)
+{
+	(void)arg;
+
+	for (int i = 0; i < waves; i++) {
+		for (int j = 0; j < width; j++)
+			uthread_create(worker, NULL);
+
+		/* Let the whole wave run and exit */
+		uthread_yield();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct uthread_pool_stats stats;
+
+	if (argc > 1)
+		waves = atoi(argv[1]);
+	if (argc > 2)
+		width = atoi(argv[2]);
+
+	uthread_run(false, spawner, NULL);
+	uthread_pool_get_stats(&stats);
+
+	printf("threads run: %d\n", done);
+	printf("pool hits: %zu, misses: %zu, recycled: %zu, released: %zu\n",
+	       stats.hits, stats.misses, stats.recycled, stats.released);
+
+	if (done != waves * width || stats.hits + stats.misses < (size_t)done)
+		return 1;
+	return 0;
+}
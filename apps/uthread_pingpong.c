@@ -0,0 +1,56 @@
+/*
+ * Context switch benchmark
+ *
+ * Two threads yield to each other back and forth so that every call to
+ * uthread_yield() is exactly one context switch. Reports the average cost of a
+ * switch in nanoseconds.
+ *
+ * Usage: uthread_pingpong.x [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+static long iterations = 1000000;
+
+static void pong(void *arg)
+{
+	(void)arg;
+
+	for (long i = 0; i < iterations; i++)
+		uthread_yield();
+}
+
+static void ping(void *arg)
+{
+	struct timespec start, end;
+	(void)arg;
+
+	uthread_create(pong, NULL);
+
+	/* Let pong start and block in its first yield */
+	uthread_yield();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < iterations; i++)
+		uthread_yield();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* The idle thread also takes part in the rotation */
+	double ns = (end.tv_sec - start.tv_sec) * 1e9
+		+ (end.tv_nsec - start.tv_nsec);
+	printf("%ld yields, %.1f ns/switch\n", iterations,
+	       ns / (iterations * 3.0));
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		iterations = atol(argv[1]);
+
+	uthread_run(false, ping, NULL);
+	return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Shard-per-core test
+ *
+ * Starts several pthreads that each call uthread_run() at the same time, so
+ * that each runs its own independent scheduler. In every shard, a ring of
+ * threads passes a token around through semaphores while other threads yield
+ * in a loop, optionally with preemption. Each shard checks that its token made
+ * every hop and that its threads all ran, then the time taken is printed.
+ *
+ * Usage: uthread_shards.x [shards] [hops] [preempt]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define RING 16
+#define YIELDERS 16
+#define YIELDS 1000
+
+struct member {
+	struct shard *shard;
+	int id;
+};
+
+struct shard {
+	pthread_t pthread;
+	sem_t sems[RING];
+	struct member members[RING];
+	long hops;
+	long yields;
+	int ok;
+};
+
+static long hops = 100000;
+static int preempt;
+
+static void pass(void *arg)
+{
+	struct member *m = arg;
+	struct shard *s = m->shard;
+
+	while (1) {
+		sem_down(s->sems[m->id]);
+		if (s->hops >= hops) {
+			/* Let the next one see the end as well */
+			sem_up(s->sems[(m->id + 1) % RING]);
+			break;
+		}
+		s->hops++;
+		sem_up(s->sems[(m->id + 1) % RING]);
+	}
+}
+
+static void yielder(void *arg)
+{
+	struct shard *s = arg;
+
+	for (int i = 0; i < YIELDS; i++) {
+		s->yields++;
+		uthread_yield();
+	}
+}
+
+static void start(void *arg)
+{
+	struct shard *s = arg;
+
+	for (int i = 0; i < RING; i++) {
+		s->members[i].shard = s;
+		s->members[i].id = i;
+		uthread_create(pass, &s->members[i]);
+	}
+	for (int i = 0; i < YIELDERS; i++)
+		uthread_create(yielder, s);
+
+	sem_up(s->sems[0]);
+}
+
+static void *run_shard(void *arg)
+{
+	struct shard *s = arg;
+
+	for (int i = 0; i < RING; i++)
+		s->sems[i] = sem_create(0);
+
+	s->ok = uthread_run(preempt, start, s) == 0
+		&& s->hops == hops && s->yields == (long)YIELDERS * YIELDS;
+
+	for (int i = 0; i < RING; i++)
+		sem_destroy(s->sems[i]);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec begin, end;
+	int nshards = 4, ok = 1;
+	struct shard *shards;
+
+	if (argc > 1)
+		nshards = atoi(argv[1]);
+	if (argc > 2)
+		hops = atol(argv[2]);
+	if (argc > 3)
+		preempt = atoi(argv[3]) > 0;
+
+	shards = calloc(nshards, sizeof(*shards));
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (int i = 0; i < nshards; i++)
+		pthread_create(&shards[i].pthread, NULL, run_shard, &shards[i]);
+	for (int i = 0; i < nshards; i++) {
+		pthread_join(shards[i].pthread, NULL);
+		ok &= shards[i].ok;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%d shards, %ld hops each: %.1f ms, %s\n", nshards, hops,
+	       (end.tv_sec - begin.tv_sec) * 1e3
+	       + (end.tv_nsec - begin.tv_nsec) / 1e6, ok ? "ok" : "FAILED");
+	free(shards);
+	return !ok;
+}
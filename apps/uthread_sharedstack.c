@@ -0,0 +1,88 @@
+/*
+ * Shared stack test
+ *
+ * Creates many threads in shared stack mode that each keep a value on their
+ * stack and block on a semaphore, interleaved with threads on their own stack.
+ * Once every thread is parked, they are all released and each checks that the
+ * frames it left on the shared stack were restored intact.
+ *
+ * Usage: uthread_sharedstack.x [threads] [preempt]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+static int nthreads = 10000;
+static int parked, checked, corrupted;
+static sem_t gate;
+
+static void waiter(void *arg)
+{
+	long id = (long)arg;
+	volatile char pattern[256];
+
+	memset((char *)pattern, (int)id, sizeof(pattern));
+	parked++;
+	sem_down(gate);
+
+	for (size_t i = 0; i < sizeof(pattern); i++) {
+		if (pattern[i] != (char)id) {
+			corrupted++;
+			break;
+		}
+	}
+	checked++;
+
+	/* Give the other threads a chance to run on the shared stack */
+	uthread_yield();
+}
+
+static void dedicated(void *arg)
+{
+	(void)arg;
+
+	sem_down(gate);
+	checked++;
+}
+
+static void spawner(void *arg)
+{
+	uthread_attr_t attr;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	uthread_attr_setsharedstack(&attr, true);
+	for (long i = 0; i < nthreads; i++) {
+		if (uthread_create_ex(&attr, waiter, (void *)i))
+			exit(1);
+		if (i % 100 == 0 && uthread_create(dedicated, NULL))
+			exit(1);
+	}
+
+	while (parked < nthreads)
+		uthread_yield();
+
+	for (int i = 0; i < nthreads + (nthreads + 99) / 100; i++)
+		sem_up(gate);
+}
+
+int main(int argc, char **argv)
+{
+	bool preempt = false;
+
+	if (argc > 1)
+		nthreads = atoi(argv[1]);
+	if (argc > 2)
+		preempt = atoi(argv[2]) > 0;
+
+	gate = sem_create(0);
+	uthread_run(preempt, spawner, NULL);
+	sem_destroy(gate);
+
+	printf("%d threads checked, %d corrupted\n", checked, corrupted);
+	return checked != nthreads + (nthreads + 99) / 100 || corrupted;
+}
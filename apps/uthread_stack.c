@@ -0,0 +1,67 @@
+/*
+ * Per-thread stack size test
+ *
+ * Runs a thread on a small 8 KiB stack next to a thread on a 1 MiB stack that
+ * recurses deeply. When given the `overflow` argument, the small thread
+ * recurses past the end of its stack, which must fault on the guard page
+ * (SIGSEGV) rather than silently corrupt memory.
+ *
+ * Usage: uthread_stack.x [overflow]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uthread.h>
+
+static int overflow;
+
+/* Use about @depth KiB of stack */
+static int recurse(int depth)
+{
+	volatile char frame[1024];
+
+	memset((char *)frame, depth, sizeof(frame));
+	if (depth <= 1)
+		return frame[0];
+	return recurse(depth - 1) + frame[1];
+}
+
+static void small(void *arg)
+{
+	(void)arg;
+
+	printf("small: %d\n", recurse(overflow ? 64 : 2));
+}
+
+static void large(void *arg)
+{
+	(void)arg;
+
+	printf("large: %d\n", recurse(512));
+}
+
+static void thread1(void *arg)
+{
+	uthread_attr_t attr;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	uthread_attr_setstacksize(&attr, 8 * 1024);
+	if (uthread_create_ex(&attr, small, NULL))
+		exit(1);
+
+	uthread_attr_setstacksize(&attr, 1024 * 1024);
+	if (uthread_create_ex(&attr, large, NULL))
+		exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "overflow"))
+		overflow = 1;
+
+	uthread_run(false, thread1, NULL);
+	return 0;
+}
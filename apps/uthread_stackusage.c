@@ -0,0 +1,82 @@
+/*
+ * Stack usage measurement test
+ *
+ * Measures the stack usage of threads running two different entry functions,
+ * one using about 1 KiB of stack and one about 12 KiB, and prints the usage
+ * report once all threads are done.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uthread.h>
+
+static int recurse(int depth);
+
+/* Called through a pointer so that the compiler does not unroll recursion */
+static int (*volatile recurse_ptr)(int) = recurse;
+
+/* Use about @depth KiB of stack */
+static int recurse(int depth)
+{
+	volatile char frame[1024];
+
+	memset((char *)frame, depth, sizeof(frame));
+	if (depth <= 1)
+		return frame[0];
+	return recurse_ptr(depth - 1) + frame[1];
+}
+
+static void shallow(void *arg)
+{
+	(void)arg;
+
+	recurse(1);
+}
+
+static void deep(void *arg)
+{
+	(void)arg;
+
+	recurse(12);
+}
+
+static void spawner(void *arg)
+{
+	(void)arg;
+
+	for (int i = 0; i < 10; i++) {
+		uthread_create(shallow, NULL);
+		uthread_create(deep, NULL);
+		uthread_yield();
+	}
+}
+
+int main(void)
+{
+	struct uthread_stack_usage usage[4];
+	int count;
+
+	uthread_stack_measure(true);
+	uthread_run(false, spawner, NULL);
+	uthread_stack_dump_usage(stdout);
+
+	/* spawner, shallow and deep */
+	count = uthread_stack_get_usage(usage, 4);
+	if (count != 3)
+		return 1;
+
+	for (int i = 0; i < count; i++) {
+		if (usage[i].func == shallow && (usage[i].threads != 10
+		    || usage[i].max_depth > 4 * 1024))
+			return 1;
+		if (usage[i].func == deep && (usage[i].threads != 10
+		    || usage[i].max_depth < 12 * 1024
+		    || usage[i].max_depth > 16 * 1024))
+			return 1;
+	}
+
+	printf("stack usage OK\n");
+	return 0;
+}
@@ -1,14 +1,31 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
 
-/* Size of the stack for a thread (in bytes) */
-#define UTHREAD_STACK_SIZE 32768
+#ifndef UTHREAD_CTX_UCONTEXT
+/*
+ * Implemented in switch_<arch>.S
+ *
+ * uthread_ctx_swap() pushes the callee-saved state of the running context onto
+ * its stack, stores the resulting stack pointer in @save_sp and resumes the
+ * context whose stack pointer is @load_sp. uthread_ctx_trampoline() is where a
+ * freshly initialized context starts executing.
+ */
+void uthread_ctx_swap(void **save_sp, void *load_sp);
+void uthread_ctx_trampoline(void);
+#endif
 
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 {
+#ifdef UTHREAD_CTX_UCONTEXT
 	/*
 	 * swapcontext() saves the current context in structure pointer by @prev
 	 * and actives the context pointed by @next
@@ -17,16 +34,87 @@ void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 		perror("swapcontext");
 		exit(1);
 	}
+#else
+	/*
+	 * Unlike swapcontext(), this does not save or restore the signal mask,
+	 * so callers must keep preemption disabled until they are resumed
+	 */
+	uthread_ctx_swap(&prev->sp, next->sp);
+#endif
+}
+
+/*
+ * uthread_ctx_page_size - Size of a memory page, also used as guard region
+ */
+static size_t uthread_ctx_page_size(void)
+{
+	static size_t page_size;
+
+	if (!page_size)
+		page_size = sysconf(_SC_PAGESIZE);
+	return page_size;
+}
+
+size_t uthread_ctx_stack_size(size_t size)
+{
+	size_t page_size = uthread_ctx_page_size();
+
+	if (!size)
+		size = UTHREAD_STACK_SIZE;
+	return (size + page_size - 1) & ~(page_size - 1);
+}
+
+void *uthread_ctx_alloc_stack(size_t size)
+{
+	size_t guard = uthread_ctx_page_size();
+	char *base;
+
+	/*
+	 * Reserve the guard page and the stack in one mapping; the kernel only
+	 * commits stack pages when the thread first touches them
+	 */
+	base = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		    -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	/* Stacks grow down, so the guard page sits at the lowest address */
+	if (mprotect(base, guard, PROT_NONE)) {
+		munmap(base, guard + size);
+		return NULL;
+	}
+
+	return base + guard;
 }
 
-void *uthread_ctx_alloc_stack(void)
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size)
 {
-	return malloc(UTHREAD_STACK_SIZE);
+	size_t guard = uthread_ctx_page_size();
+
+	munmap((char *)top_of_stack - guard, guard + size);
 }
 
-void uthread_ctx_destroy_stack(void *top_of_stack)
+/* Byte pattern painted over stacks whose usage is measured */
+#define UTHREAD_STACK_CANARY 0xa5
+
+void uthread_ctx_paint_stack(void *top_of_stack, size_t size, size_t depth)
 {
-	free(top_of_stack);
+	if (depth > size)
+		depth = size;
+	memset((char *)top_of_stack + size - depth, UTHREAD_STACK_CANARY, depth);
+}
+
+size_t uthread_ctx_stack_depth(void *top_of_stack, size_t size)
+{
+	const uint64_t canary = 0x0101010101010101ULL * UTHREAD_STACK_CANARY;
+	const uint64_t *word = top_of_stack;
+	size_t i = 0;
+
+	/* Stacks grow down: the first overwritten word marks the peak */
+	while (i < size / sizeof(uint64_t) && word[i] == canary)
+		i++;
+	return size - i * sizeof(uint64_t);
 }
 
 /*
@@ -37,16 +125,18 @@ void uthread_ctx_destroy_stack(void *top_of_stack)
 static void uthread_ctx_bootstrap(uthread_func_t func, void *arg)
 {
 	/*
-	 * Enable interrupts right after being elected to run for the first time
+	 * Finish the switch to this thread and enable interrupts right after
+	 * being elected to run for the first time
 	 */
-	preempt_enable();
+	uthread_resume();
 
 	/* Execute thread and when done, exit */
 	func(arg);
 	uthread_exit();
 }
 
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+#ifdef UTHREAD_CTX_UCONTEXT
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
 		     uthread_func_t func, void *arg)
 {
 	/*
@@ -59,7 +149,7 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	 * Change context @uctx's stack to the specified stack
 	 */
 	uctx->uc_stack.ss_sp = top_of_stack;
-	uctx->uc_stack.ss_size = UTHREAD_STACK_SIZE;
+	uctx->uc_stack.ss_size = size;
 
 	/*
 	 * Finish setting up context @uctx:
@@ -74,3 +164,107 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	return 0;
 }
 
+int uthread_ctx_init_raw(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
+			 uthread_func_t func, void *arg)
+{
+	if (getcontext(uctx))
+		return -1;
+
+	uctx->uc_stack.ss_sp = top_of_stack;
+	uctx->uc_stack.ss_size = size;
+	makecontext(uctx, (void (*)(void)) func, 1, arg);
+
+	return 0;
+}
+
+void *uthread_ctx_stack_pointer(uthread_ctx_t *uctx)
+{
+#if defined(__x86_64__)
+	return (void *)uctx->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+	return (void *)uctx->uc_mcontext.sp;
+#else
+	(void)uctx;
+	return NULL;
+#endif
+}
+#else
+/*
+ * uthread_ctx_make - Build the initial frame of a context
+ * @uctx: Pointer to context to initialize
+ * @top_of_stack: Pointer to the top of a valid stack segment
+ * @size: Size of the stack segment
+ * @entry: Function called by the trampoline
+ * @arg0: First argument passed to @entry
+ * @arg1: Second argument passed to @entry
+ */
+static void uthread_ctx_make(uthread_ctx_t *uctx, void *top_of_stack,
+			     size_t size, void *entry, void *arg0, void *arg1)
+{
+	uint64_t *frame;
+
+	/*
+	 * Stacks grow down: start from the end of the segment, aligned on 16
+	 * bytes as required by both ABIs once the trampoline is entered
+	 */
+	uintptr_t top = ((uintptr_t)top_of_stack + size) & ~(uintptr_t)15;
+
+	/*
+	 * Build the frame that uthread_ctx_swap() expects to pop (see the layout
+	 * in switch_<arch>.S), so that the first switch to @uctx "returns" into
+	 * uthread_ctx_trampoline() which then calls @entry(@arg0, @arg1). The
+	 * floating point control state is inherited from the creating thread.
+	 */
+#if defined(__x86_64__)
+	uint32_t mxcsr;
+	uint16_t fpucw;
+
+	__asm__ volatile ("stmxcsr %0" : "=m" (mxcsr));
+	__asm__ volatile ("fnstcw %0" : "=m" (fpucw));
+
+	frame = (uint64_t *)top - 8;
+	memset(frame, 0, 8 * sizeof(uint64_t));
+	frame[0] = mxcsr | ((uint64_t)fpucw << 32);
+	frame[3] = (uintptr_t)arg1;				/* r13 */
+	frame[4] = (uintptr_t)arg0;				/* r12 */
+	frame[5] = (uintptr_t)entry;				/* rbx */
+	frame[7] = (uintptr_t)uthread_ctx_trampoline;		/* return */
+#elif defined(__aarch64__)
+	uint64_t fpcr;
+
+	__asm__ volatile ("mrs %0, fpcr" : "=r" (fpcr));
+
+	frame = (uint64_t *)top - 22;
+	memset(frame, 0, 22 * sizeof(uint64_t));
+	frame[0] = (uintptr_t)arg0;				/* x19 */
+	frame[1] = (uintptr_t)arg1;				/* x20 */
+	frame[2] = (uintptr_t)entry;				/* x21 */
+	frame[11] = (uintptr_t)uthread_ctx_trampoline;		/* x30 */
+	frame[20] = fpcr;
+#else
+#error "No context switch backend for this architecture, build with CTX=ucontext"
+#endif
+
+	uctx->sp = frame;
+}
+
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
+		     uthread_func_t func, void *arg)
+{
+	uthread_ctx_make(uctx, top_of_stack, size,
+			 (void *)uthread_ctx_bootstrap, (void *)func, arg);
+	return 0;
+}
+
+int uthread_ctx_init_raw(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
+			 uthread_func_t func, void *arg)
+{
+	uthread_ctx_make(uctx, top_of_stack, size, (void *)func, arg, NULL);
+	return 0;
+}
+
+void *uthread_ctx_stack_pointer(uthread_ctx_t *uctx)
+{
+	return uctx->sp;
+}
+#endif
@@ -0,0 +1,166 @@
+#include <stddef.h>
+
+#include "heap.h"
+
+/*
+ * iheap_meld - Meld two heap trees into one
+ * @heap: Heap whose ordering applies
+ * @a: Root of a tree, or NULL
+ * @b: Root of another tree, or NULL
+ *
+ * The larger root becomes the first child of the smaller one. The siblings of
+ * both roots must already have been cleared.
+ *
+ * Return: Root of the melded tree.
+ */
+static heap_link_t *iheap_meld(iheap_t *heap, heap_link_t *a, heap_link_t *b) {
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (heap->cmp(b, a) < 0) {
+        heap_link_t *tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    // Leftmost children point back to their parent
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != NULL) {
+        a->child->prev = b;
+    }
+    a->child = b;
+    return a;
+}
+
+/*
+ * iheap_merge_pairs - Meld a list of sibling trees into one
+ * @heap: Heap whose ordering applies
+ * @first: First tree of the list, or NULL
+ *
+ * Siblings are melded by pairs from left to right, then the pairs are melded
+ * from right to left, which is what keeps the heap operations logarithmic.
+ *
+ * Return: Root of the melded tree, NULL if @first is NULL.
+ */
+static heap_link_t *iheap_merge_pairs(iheap_t *heap, heap_link_t *first) {
+    // Left to right, stacking the melded pairs
+    heap_link_t *pairs = NULL;
+    while (first != NULL) {
+        heap_link_t *a = first;
+        heap_link_t *b = a->next;
+        first = b != NULL ? b->next : NULL;
+
+        a->next = NULL;
+        a->prev = NULL;
+        if (b != NULL) {
+            b->next = NULL;
+            b->prev = NULL;
+        }
+        heap_link_t *pair = iheap_meld(heap, a, b);
+        pair->next = pairs;
+        pairs = pair;
+    }
+
+    // Right to left, unstacking them
+    heap_link_t *root = NULL;
+    while (pairs != NULL) {
+        heap_link_t *pair = pairs;
+        pairs = pair->next;
+        pair->next = NULL;
+        root = iheap_meld(heap, root, pair);
+    }
+    return root;
+}
+
+int iheap_init(iheap_t *heap, iheap_cmp_t cmp) {
+    if (heap == NULL || cmp == NULL) {
+        // ERROR: Uninitialized heap / ordering
+        return -1;
+    }
+    heap->length = 0;
+    heap->root = NULL;
+    heap->cmp = cmp;
+    return 0;
+}
+
+int iheap_insert(iheap_t *heap, heap_link_t *link) {
+    if (heap == NULL || link == NULL) {
+        // ERROR: Uninitialized heap / link
+        return -1;
+    }
+
+    link->child = NULL;
+    link->next = NULL;
+    link->prev = NULL;
+    heap->root = iheap_meld(heap, heap->root, link);
+    ++(heap->length);
+    return 0;
+}
+
+int iheap_peek(iheap_t *heap, heap_link_t **link) {
+    if (heap == NULL || link == NULL || heap->length == 0) {
+        // ERROR: Uninitialized heap / link or empty heap
+        return -1;
+    }
+
+    *link = heap->root;
+    return 0;
+}
+
+int iheap_pop(iheap_t *heap, heap_link_t **link) {
+    if (heap == NULL || link == NULL || heap->length == 0) {
+        // ERROR: Uninitialized heap / link or empty heap
+        return -1;
+    }
+
+    heap_link_t *root = heap->root;
+    heap->root = iheap_merge_pairs(heap, root->child);
+    root->child = NULL;
+    --(heap->length);
+
+    *link = root;
+    return 0;
+}
+
+int iheap_remove(iheap_t *heap, heap_link_t *link) {
+    if (heap == NULL || link == NULL || heap->length == 0) {
+        // ERROR: Uninitialized heap / link or empty heap
+        return -1;
+    }
+
+    if (link == heap->root) {
+        heap_link_t *root;
+        return iheap_pop(heap, &root);
+    }
+
+    // Unlink the subtree of @link from its siblings, then meld it back once
+    // @link is out of it
+    if (link->prev->child == link) {
+        link->prev->child = link->next;
+    } else {
+        link->prev->next = link->next;
+    }
+    if (link->next != NULL) {
+        link->next->prev = link->prev;
+    }
+
+    heap_link_t *subtree = iheap_merge_pairs(heap, link->child);
+    heap->root = iheap_meld(heap, heap->root, subtree);
+    link->child = NULL;
+    link->next = NULL;
+    link->prev = NULL;
+    --(heap->length);
+    return 0;
+}
+
+int iheap_length(iheap_t *heap) {
+    if (heap == NULL) {
+        // ERROR: Uninitialized heap
+        return -1;
+    }
+    return heap->length;
+}
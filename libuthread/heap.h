@@ -0,0 +1,112 @@
+#ifndef _HEAP_H
+#define _HEAP_H
+
+#include <stddef.h>
+
+/*
+ * heap_link_t - Intrusive heap link
+ *
+ * Link fields to embed in a structure so that it can be put in an intrusive
+ * heap (iheap_t) without any allocation. A link can only be in one heap at a
+ * time.
+ */
+typedef struct heap_link {
+	struct heap_link *child;
+	struct heap_link *next;
+	struct heap_link *prev;
+} heap_link_t;
+
+/*
+ * iheap_cmp_t - Intrusive heap ordering function type
+ * @a: Link of an item
+ * @b: Link of another item
+ *
+ * Return: A negative value if @a must come out of the heap before @b, a
+ * positive value if after, 0 if either order will do.
+ */
+typedef int (*iheap_cmp_t)(const heap_link_t *a, const heap_link_t *b);
+
+/*
+ * iheap_t - Intrusive min-heap type
+ *
+ * Priority queue of links, ordered by a comparison function: the first link
+ * out is always the smallest one. The heap is a pairing heap, whose insertion
+ * is O(1) and whose removal of the smallest link, or of any link, is O(log n)
+ * amortized. Links of equal value come out in no particular order.
+ *
+ * The heap object is meant to be embedded, and must be initialized with
+ * iheap_init() before use.
+ */
+typedef struct iheap {
+	int length;
+	heap_link_t *root;
+	iheap_cmp_t cmp;
+} iheap_t;
+
+/*
+ * iheap_entry - Get the structure containing a link
+ * @link: Address of the link
+ * @type: Type of the structure the link is embedded in
+ * @member: Name of the link within @type
+ */
+#define iheap_entry(link, type, member) \
+	((type *)((char *)(link) - offsetof(type, member)))
+
+/*
+ * iheap_init - Initialize an empty intrusive heap
+ * @heap: Heap to initialize
+ * @cmp: Function ordering the links of the heap
+ *
+ * Return: -1 if @heap or @cmp are NULL. 0 otherwise.
+ */
+int iheap_init(iheap_t *heap, iheap_cmp_t cmp);
+
+/*
+ * iheap_insert - Insert link
+ * @heap: Heap in which to insert link
+ * @link: Link to insert, which must not already be in a heap
+ *
+ * Return: -1 if @heap or @link are NULL. 0 if @link was successfully inserted
+ * in @heap.
+ */
+int iheap_insert(iheap_t *heap, heap_link_t *link);
+
+/*
+ * iheap_peek - Get the smallest link without removing it
+ * @heap: Heap to look into
+ * @link: Address of link pointer where the smallest link is received
+ *
+ * Return: -1 if @heap or @link are NULL, or if the heap is empty. 0 if @link
+ * was set with the smallest link of @heap.
+ */
+int iheap_peek(iheap_t *heap, heap_link_t **link);
+
+/*
+ * iheap_pop - Remove the smallest link
+ * @heap: Heap in which to remove the smallest link
+ * @link: Address of link pointer where the smallest link is received
+ *
+ * Return: -1 if @heap or @link are NULL, or if the heap is empty. 0 if @link
+ * was set with the smallest link of @heap, which was removed from it.
+ */
+int iheap_pop(iheap_t *heap, heap_link_t **link);
+
+/*
+ * iheap_remove - Remove any link
+ * @heap: Heap holding @link
+ * @link: Link to remove, which must be in @heap
+ *
+ * Return: -1 if @heap or @link are NULL, or if @heap is empty. 0 once @link
+ * was removed from @heap.
+ */
+int iheap_remove(iheap_t *heap, heap_link_t *link);
+
+/*
+ * iheap_length - Intrusive heap length
+ * @heap: Heap to get the length of
+ *
+ * Return: -1 if @heap is NULL. Number of links in @heap otherwise.
+ */
+int iheap_length(iheap_t *heap);
+
+#endif /* _HEAP_H */
@@ -0,0 +1,563 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "queue.h"
+#include "mutex.h"
+#include "private.h"
+
+// Set in the state of a mutex while threads are in its waiting queue
+#define MUTEX_WAITERS ((uintptr_t)1)
+
+// Times a thread checks a locked mutex before blocking, when the owner may be
+// running on another worker
+#define MUTEX_SPINS 100
+
+/*
+ * uthread_mutex_t - Mutex type
+ *
+ * The state word holds the TCB address of the owner, 0 when the mutex is free,
+ * along with MUTEX_WAITERS. The uncontended paths only ever go through the
+ * state, with a single compare and swap. Once the bit is set, the owner has to
+ * take the spinlock to unlock the mutex, and wake up the first waiter.
+ *
+ * The bit is only set or cleared under the spinlock, and is set whenever the
+ * waiting queue is not empty.
+ */
+struct uthread_mutex {
+    _Atomic uintptr_t state; // Owner, and MUTEX_WAITERS
+    uthread_spinlock_t lock; // Waiting queue, across workers
+    size_t waiters; // Threads blocked in uthread_mutex_lock() or waiting on
+                    // a condition with the mutex, woken or not
+    iqueue_t waiting_queue;
+};
+
+/*
+ * uthread_mutex_create - Create mutex
+ *
+ * Allocate and initialize an unlocked mutex.
+ *
+ * Return: Pointer to initialized mutex. NULL in case of failure when
+ * allocating the new mutex.
+ */
+uthread_mutex_t uthread_mutex_create(void) {
+    // Allocate atomically, the allocator is not safe against preemption
+    preempt_disable();
+    uthread_mutex_t new_mutex = malloc(sizeof(struct uthread_mutex));
+    preempt_enable();
+    if (new_mutex == NULL) {
+        // ERROR: Bad malloc
+        return NULL;
+    }
+
+    atomic_init(&(new_mutex->state), 0);
+    uthread_spin_init(&(new_mutex->lock));
+    new_mutex->waiters = 0;
+    iqueue_init(&(new_mutex->waiting_queue));
+    return new_mutex;
+}
+
+/*
+ * uthread_mutex_destroy - Deallocate a mutex
+ * @mutex: Mutex to deallocate
+ *
+ * Deallocate mutex @mutex.
+ *
+ * Return: -1 if @mutex is NULL, locked, or if other threads are still being
+ * blocked on @mutex. 0 if @mutex was successfully destroyed.
+ */
+int uthread_mutex_destroy(uthread_mutex_t mutex) {
+    if (mutex == NULL) {
+        // ERROR: Bad mutex destroy
+        return -1;
+    }
+
+    // A thread woken up by uthread_mutex_unlock() still has to take the
+    // mutex, possibly on another worker
+    preempt_disable();
+    uthread_spin_lock(&(mutex->lock));
+    bool busy = atomic_load(&(mutex->state)) != 0 || mutex->waiters > 0;
+    uthread_spin_unlock(&(mutex->lock));
+    preempt_enable();
+    if (busy) {
+        // ERROR: Bad mutex destroy, mutex locked or threads still blocked on it
+        return -1;
+    }
+
+    preempt_disable();
+    free(mutex);
+    preempt_enable();
+    return 0;
+}
+
+// Take @mutex for @self if it is free, keeping MUTEX_WAITERS as is
+bool uthread_mutex_take(uthread_mutex_t mutex, uintptr_t self) {
+    uintptr_t state = atomic_load_explicit(&(mutex->state),
+        memory_order_relaxed);
+    while ((state & ~MUTEX_WAITERS) == 0) {
+        if (atomic_compare_exchange_weak_explicit(&(mutex->state), &state,
+                state | self, memory_order_acquire, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Wait until @mutex is taken for @self (preemption disabled, spinlock held)
+// When @queued, the thread is already in the waiting queue, where
+// uthread_cond_broadcast() moved it, and waits to be dequeued first
+void uthread_mutex_wait(uthread_mutex_t mutex, uintptr_t self, bool queued) {
+    struct uthread_tcb *current_thread = (struct uthread_tcb *)self;
+    int *dequeued = uthread_wait_status(current_thread);
+    bool woken = queued;
+    while (1) {
+        if (!queued) {
+            uintptr_t state = atomic_load_explicit(&(mutex->state),
+                memory_order_relaxed);
+            if ((state & ~MUTEX_WAITERS) == 0) {
+                // Free: take it, other threads may still be in line
+                if (atomic_compare_exchange_weak_explicit(&(mutex->state),
+                        &state, self | (mutex->waiting_queue.head != NULL
+                            ? MUTEX_WAITERS : 0),
+                        memory_order_acquire, memory_order_relaxed)) {
+                    return;
+                }
+                continue;
+            }
+
+            // Make the owner take the slow path to unlock it, then wait until
+            // it dequeues this thread. A thread woken up to find the mutex
+            // taken again waits first in line.
+            if (!(state & MUTEX_WAITERS)
+                    && !atomic_compare_exchange_weak_explicit(&(mutex->state),
+                        &state, state | MUTEX_WAITERS,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                continue;
+            }
+            *dequeued = 0;
+            if (woken) {
+                iqueue_enqueue_head(&(mutex->waiting_queue),
+                    uthread_wait_link(current_thread));
+            } else {
+                iqueue_enqueue(&(mutex->waiting_queue),
+                    uthread_wait_link(current_thread));
+            }
+        }
+        while (!*dequeued) {
+            uthread_spin_unlock(&(mutex->lock));
+            uthread_block();
+            preempt_disable();
+            uthread_spin_lock(&(mutex->lock));
+        }
+        queued = false;
+        woken = true;
+    }
+}
+
+// Contended path of uthread_mutex_lock()
+int uthread_mutex_lock_slow(uthread_mutex_t mutex, uintptr_t self) {
+    uintptr_t state = atomic_load_explicit(&(mutex->state),
+        memory_order_relaxed);
+    if ((state & ~MUTEX_WAITERS) == self) {
+        // ERROR: Mutex already owned by the caller, would deadlock
+        return -1;
+    }
+
+    // The owner may be about to unlock the mutex on another worker: spin for
+    // a moment, unless threads already wait for it
+    if (uthread_num_workers() > 1) {
+        for (int spins = 0; spins < MUTEX_SPINS; spins++) {
+            state = atomic_load_explicit(&(mutex->state),
+                memory_order_relaxed);
+            if (state & MUTEX_WAITERS) {
+                break;
+            }
+            if (state == 0 && uthread_mutex_take(mutex, self)) {
+                return 0;
+            }
+        }
+    }
+
+    preempt_disable();
+    uthread_spin_lock(&(mutex->lock));
+    ++(mutex->waiters);
+    uthread_mutex_wait(mutex, self, false);
+    --(mutex->waiters);
+    uthread_spin_unlock(&(mutex->lock));
+    preempt_enable();
+    return 0;
+}
+
+/*
+ * uthread_mutex_lock - Lock a mutex
+ * @mutex: Mutex to lock
+ *
+ * Take mutex @mutex, making the calling thread its owner. Locking a mutex
+ * owned by another thread will cause the caller thread to be blocked until it
+ * can take the mutex.
+ *
+ * Return: -1 if @mutex is NULL or already owned by the calling thread. 0 if
+ * @mutex was successfully locked.
+ */
+int uthread_mutex_lock(uthread_mutex_t mutex) {
+    if (mutex == NULL) {
+        // ERROR: Uninitialized mutex
+        return -1;
+    }
+
+    uintptr_t self = (uintptr_t)uthread_self();
+    uintptr_t unlocked = 0;
+    if (atomic_compare_exchange_strong_explicit(&(mutex->state), &unlocked,
+            self, memory_order_acquire, memory_order_relaxed)) {
+        return 0;
+    }
+    return uthread_mutex_lock_slow(mutex, self);
+}
+
+/*
+ * uthread_mutex_trylock - Lock a mutex without blocking
+ * @mutex: Mutex to lock
+ *
+ * Take mutex @mutex if it is free, even while other threads wait for it.
+ *
+ * Return: -1 if @mutex is NULL or already locked. 0 if @mutex was successfully
+ * locked.
+ */
+int uthread_mutex_trylock(uthread_mutex_t mutex) {
+    if (mutex == NULL) {
+        // ERROR: Uninitialized mutex
+        return -1;
+    }
+
+    if (!uthread_mutex_take(mutex, (uintptr_t)uthread_self())) {
+        // ERROR: Mutex already locked
+        return -1;
+    }
+    return 0;
+}
+
+// Contended path of uthread_mutex_unlock()
+void uthread_mutex_unlock_slow(uthread_mutex_t mutex) {
+    // Free the mutex and dequeue the first in line, atomically with respect to
+    // threads getting in line
+    preempt_disable();
+    uthread_spin_lock(&(mutex->lock));
+    queue_link_t *link;
+    int waiting = iqueue_dequeue(&(mutex->waiting_queue), &link);
+    atomic_store_explicit(&(mutex->state), mutex->waiting_queue.head != NULL
+        ? MUTEX_WAITERS : 0, memory_order_release);
+    if (waiting == 0) {
+        *uthread_wait_status(uthread_from_wait_link(link)) = 1;
+    }
+    uthread_spin_unlock(&(mutex->lock));
+
+    // Unblock it, it takes the mutex once it runs unless another thread did
+    if (waiting == 0) {
+        uthread_unblock(uthread_from_wait_link(link));
+    }
+    preempt_enable();
+}
+
+/*
+ * uthread_mutex_unlock - Unlock a mutex
+ * @mutex: Mutex to unlock
+ *
+ * Release mutex @mutex. If threads are waiting for it, the first one (i.e. the
+ * oldest) is also unblocked.
+ *
+ * Return: -1 if @mutex is NULL or not owned by the calling thread. 0 if @mutex
+ * was successfully unlocked.
+ */
+int uthread_mutex_unlock(uthread_mutex_t mutex) {
+    if (mutex == NULL) {
+        // ERROR: Uninitialized mutex
+        return -1;
+    }
+
+    uintptr_t self = (uintptr_t)uthread_self();
+    uintptr_t locked = self;
+    if (atomic_compare_exchange_strong_explicit(&(mutex->state), &locked, 0,
+            memory_order_release, memory_order_relaxed)) {
+        return 0;
+    }
+    if ((locked & ~MUTEX_WAITERS) != self) {
+        // ERROR: Mutex not owned by the caller
+        return -1;
+    }
+
+    // Only the owner clears its address, and threads only ever set the bit
+    uthread_mutex_unlock_slow(mutex);
+    return 0;
+}
+
+// Condition variables
+// =============================================================================
+/*
+ * uthread_cond_t - Condition variable type
+ *
+ * Waiters queue up on the condition along with the mutex they released. A
+ * signal dequeues and wakes up the first one, which then takes the mutex
+ * again. A broadcast moves the whole waiting queue onto the waiting queue of
+ * the mutex instead, in a single splice: the waiters are then woken up one at
+ * a time, as the mutex is unlocked, rather than all at once only to block on
+ * the mutex again.
+ *
+ * The waiters moved by a broadcast are not touched one by one, so they find
+ * out that they were by the epoch of the condition, which each broadcast moving
+ * waiters increments. A waiter only reads its wait status while the epoch is
+ * the one it started waiting in: after that, the status belongs to the mutex.
+ */
+struct uthread_cond {
+    uthread_spinlock_t lock; // Waiting queue, across workers
+    unsigned long epoch; // Broadcasts that moved waiters so far
+    uthread_mutex_t mutex; // Mutex of the waiters
+    size_t waiters; // Threads in uthread_cond_wait(), woken or not
+    iqueue_t waiting_queue;
+};
+
+/*
+ * uthread_cond_create - Create condition variable
+ *
+ * Allocate and initialize a condition variable with no waiters.
+ *
+ * Return: Pointer to initialized condition variable. NULL in case of failure
+ * when allocating the new condition variable.
+ */
+uthread_cond_t uthread_cond_create(void) {
+    // Allocate atomically, the allocator is not safe against preemption
+    preempt_disable();
+    uthread_cond_t new_cond = malloc(sizeof(struct uthread_cond));
+    preempt_enable();
+    if (new_cond == NULL) {
+        // ERROR: Bad malloc
+        return NULL;
+    }
+
+    uthread_spin_init(&(new_cond->lock));
+    new_cond->epoch = 0;
+    new_cond->mutex = NULL;
+    new_cond->waiters = 0;
+    iqueue_init(&(new_cond->waiting_queue));
+    return new_cond;
+}
+
+/*
+ * uthread_cond_destroy - Deallocate a condition variable
+ * @cond: Condition variable to deallocate
+ *
+ * Deallocate condition variable @cond.
+ *
+ * Return: -1 if @cond is NULL or if threads are still waiting on @cond. 0 if
+ * @cond was successfully destroyed.
+ */
+int uthread_cond_destroy(uthread_cond_t cond) {
+    if (cond == NULL) {
+        // ERROR: Bad cond destroy
+        return -1;
+    }
+
+    // A woken up waiter still has to check the epoch, possibly on another
+    // worker
+    preempt_disable();
+    uthread_spin_lock(&(cond->lock));
+    size_t waiters = cond->waiters;
+    uthread_spin_unlock(&(cond->lock));
+    preempt_enable();
+    if (waiters > 0) {
+        // ERROR: Bad cond destroy, threads still waiting on it
+        return -1;
+    }
+
+    preempt_disable();
+    free(cond);
+    preempt_enable();
+    return 0;
+}
+
+// Wait on @cond until signaled, or until @when if not 0
+// Returns 1 if @when came first
+int uthread_cond_wait_until(uthread_cond_t cond, uthread_mutex_t mutex,
+        int64_t when) {
+    if (cond == NULL || mutex == NULL) {
+        // ERROR: Uninitialized cond or mutex
+        return -1;
+    }
+
+    uintptr_t self = (uintptr_t)uthread_self();
+    if ((atomic_load_explicit(&(mutex->state), memory_order_relaxed)
+            & ~MUTEX_WAITERS) != self) {
+        // ERROR: Mutex not owned by the caller
+        return -1;
+    }
+
+    // The thread counts as waiting for the mutex until it has it back
+    preempt_disable();
+    if (when != 0) {
+        uthread_timeout_start(when);
+    }
+    uthread_spin_lock(&(mutex->lock));
+    ++(mutex->waiters);
+    uthread_spin_unlock(&(mutex->lock));
+
+    // Get in line before releasing the mutex, so that a signal sent once the
+    // mutex is released finds this thread
+    struct uthread_tcb *current_thread = (struct uthread_tcb *)self;
+    int *signaled = uthread_wait_status(current_thread);
+    uthread_spin_lock(&(cond->lock));
+    unsigned long epoch = cond->epoch;
+    cond->mutex = mutex;
+    ++(cond->waiters);
+    *signaled = 0;
+    iqueue_enqueue(&(cond->waiting_queue), uthread_wait_link(current_thread));
+    uthread_spin_unlock(&(cond->lock));
+    preempt_enable();
+    uthread_mutex_unlock(mutex);
+
+    // Wait to be signaled, moved onto the mutex or timed out
+    preempt_disable();
+    uthread_spin_lock(&(cond->lock));
+    bool timed_out = false;
+    while (cond->epoch == epoch && !*signaled) {
+        if (when != 0 && uthread_now() >= when) {
+            iqueue_remove(&(cond->waiting_queue),
+                uthread_wait_link(current_thread));
+            timed_out = true;
+            break;
+        }
+        uthread_spin_unlock(&(cond->lock));
+        uthread_block();
+        preempt_disable();
+        uthread_spin_lock(&(cond->lock));
+    }
+    bool moved = cond->epoch != epoch;
+    --(cond->waiters);
+    uthread_spin_unlock(&(cond->lock));
+    if (when != 0) {
+        uthread_timeout_stop();
+    }
+
+    // Take the mutex back, first waiting to be dequeued from its waiting
+    // queue if the thread was moved there and still is
+    uthread_spin_lock(&(mutex->lock));
+    uthread_mutex_wait(mutex, self, moved && !*signaled);
+    --(mutex->waiters);
+    uthread_spin_unlock(&(mutex->lock));
+    preempt_enable();
+    return timed_out ? 1 : 0;
+}
+
+/*
+ * uthread_cond_wait - Wait on a condition variable
+ * @cond: Condition variable to wait on
+ * @mutex: Mutex owned by the caller, protecting the condition
+ *
+ * Atomically release @mutex and block the calling thread until @cond is
+ * signaled, then take @mutex again before returning. The thread may also
+ * return without @cond being signaled, and must check the condition again.
+ *
+ * Return: -1 if @cond or @mutex is NULL, or if @mutex is not owned by the
+ * calling thread. 0 once @mutex is locked again.
+ */
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex) {
+    return uthread_cond_wait_until(cond, mutex, 0);
+}
+
+/*
+ * uthread_cond_timedwait - Wait on a condition variable for a bounded time
+ * @cond: Condition variable to wait on
+ * @mutex: Mutex owned by the caller, protecting the condition
+ * @timeout: Time to wait for at most, in microseconds
+ *
+ * Same as uthread_cond_wait(), but the thread stops waiting once @timeout has
+ * elapsed, and takes @mutex again.
+ *
+ * Return: -1 if @cond or @mutex is NULL, if @mutex is not owned by the calling
+ * thread or if @timeout is negative. 1 if @timeout elapsed before @cond was
+ * signaled, 0 otherwise, once @mutex is locked again.
+ */
+int uthread_cond_timedwait(uthread_cond_t cond, uthread_mutex_t mutex,
+        long timeout) {
+    if (timeout < 0) {
+        // ERROR: Invalid timeout
+        return -1;
+    }
+    return uthread_cond_wait_until(cond, mutex,
+        uthread_now() + timeout * 1000);
+}
+
+/*
+ * uthread_cond_signal - Signal a condition variable
+ * @cond: Condition variable to signal
+ *
+ * Unblock the first thread (i.e. the oldest) waiting on @cond, if any.
+ *
+ * Return: -1 if @cond is NULL. 0 if @cond was successfully signaled.
+ */
+int uthread_cond_signal(uthread_cond_t cond) {
+    if (cond == NULL) {
+        // ERROR: Uninitialized cond
+        return -1;
+    }
+
+    preempt_disable();
+    uthread_spin_lock(&(cond->lock));
+    queue_link_t *link;
+    int waiting = iqueue_dequeue(&(cond->waiting_queue), &link);
+    if (waiting == 0) {
+        *uthread_wait_status(uthread_from_wait_link(link)) = 1;
+    }
+    uthread_spin_unlock(&(cond->lock));
+    if (waiting == 0) {
+        uthread_unblock(uthread_from_wait_link(link));
+    }
+    preempt_enable();
+    return 0;
+}
+
+/*
+ * uthread_cond_broadcast - Signal a condition variable to all its waiters
+ * @cond: Condition variable to signal
+ *
+ * Unblock all the threads waiting on @cond.
+ *
+ * Return: -1 if @cond is NULL. 0 if @cond was successfully signaled.
+ */
+int uthread_cond_broadcast(uthread_cond_t cond) {
+    if (cond == NULL) {
+        // ERROR: Uninitialized cond
+        return -1;
+    }
+
+    preempt_disable();
+    uthread_spin_lock(&(cond->lock));
+    if (cond->waiting_queue.head == NULL) {
+        uthread_spin_unlock(&(cond->lock));
+        preempt_enable();
+        return 0;
+    }
+
+    // Move the waiters onto the mutex in one go. They stay blocked until
+    // dequeued by an unlock, the first one right away if the mutex is free.
+    uthread_mutex_t mutex = cond->mutex;
+    ++(cond->epoch);
+    uthread_spin_lock(&(mutex->lock));
+    iqueue_splice(&(mutex->waiting_queue), &(cond->waiting_queue));
+    uintptr_t state = atomic_fetch_or(&(mutex->state), MUTEX_WAITERS);
+    queue_link_t *link = NULL;
+    if ((state & ~MUTEX_WAITERS) == 0) {
+        iqueue_dequeue(&(mutex->waiting_queue), &link);
+        *uthread_wait_status(uthread_from_wait_link(link)) = 1;
+        if (mutex->waiting_queue.head == NULL) {
+            atomic_fetch_and(&(mutex->state), ~MUTEX_WAITERS);
+        }
+    }
+    uthread_spin_unlock(&(mutex->lock));
+    uthread_spin_unlock(&(cond->lock));
+    if (link != NULL) {
+        uthread_unblock(uthread_from_wait_link(link));
+    }
+    preempt_enable();
+    return 0;
+}
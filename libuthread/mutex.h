@@ -0,0 +1,171 @@
+#ifndef _MUTEX_H
+#define _MUTEX_H
+
+/*
+ * uthread_mutex_t - Mutex type
+ *
+ * A mutex lets a single thread at a time into a critical section. It tracks
+ * the thread owning it: only the owner may unlock it, and the owner locking it
+ * again is an error rather than a deadlock.
+ *
+ * Locking a free mutex and unlocking a mutex nobody waits for is a single
+ * atomic operation, without disabling preemption nor any system call. A thread
+ * finding the mutex locked may spin for a moment when the scheduler has several
+ * workers, as the owner may be about to unlock it on another one, then blocks
+ * until it is unlocked. A blocked thread is woken up when the mutex is
+ * unlocked, and takes it once it runs unless another thread took it first, in
+ * which case it waits again at the head of the line.
+ */
+typedef struct uthread_mutex *uthread_mutex_t;
+
+/*
+ * uthread_mutex_create - Create mutex
+ *
+ * Allocate and initialize an unlocked mutex.
+ *
+ * Return: Pointer to initialized mutex. NULL in case of failure when
+ * allocating the new mutex.
+ */
+uthread_mutex_t uthread_mutex_create(void);
+
+/*
+ * uthread_mutex_destroy - Deallocate a mutex
+ * @mutex: Mutex to deallocate
+ *
+ * Deallocate mutex @mutex. A thread woken up by uthread_mutex_unlock() counts
+ * as blocked on @mutex until it has returned from uthread_mutex_lock(), and a
+ * thread waiting on a condition variable with @mutex until it has returned
+ * from uthread_cond_wait().
+ *
+ * Return: -1 if @mutex is NULL, locked, or if other threads are still being
+ * blocked on @mutex. 0 if @mutex was successfully destroyed.
+ */
+int uthread_mutex_destroy(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_lock - Lock a mutex
+ * @mutex: Mutex to lock
+ *
+ * Take mutex @mutex, making the calling thread its owner. Locking a mutex
+ * owned by another thread will cause the caller thread to be blocked until it
+ * can take the mutex.
+ *
+ * Return: -1 if @mutex is NULL or already owned by the calling thread. 0 if
+ * @mutex was successfully locked.
+ */
+int uthread_mutex_lock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_trylock - Lock a mutex without blocking
+ * @mutex: Mutex to lock
+ *
+ * Take mutex @mutex if it is free, even while other threads wait for it.
+ *
+ * Return: -1 if @mutex is NULL or already locked. 0 if @mutex was successfully
+ * locked.
+ */
+int uthread_mutex_trylock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_unlock - Unlock a mutex
+ * @mutex: Mutex to unlock
+ *
+ * Release mutex @mutex. If threads are waiting for it, the first one (i.e. the
+ * oldest) is also unblocked.
+ *
+ * Return: -1 if @mutex is NULL or not owned by the calling thread. 0 if @mutex
+ * was successfully unlocked.
+ */
+int uthread_mutex_unlock(uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_t - Condition variable type
+ *
+ * A condition variable lets threads wait, with a mutex released, until another
+ * thread signals that the condition they wait for may have changed. All the
+ * threads waiting on a condition variable at the same time must use the same
+ * mutex.
+ *
+ * A broadcast moves all the waiters to the waiting queue of the mutex at once,
+ * without waking any of them up but the first if the mutex is free: each one
+ * is then woken up in turn by the unlock of the previous one.
+ */
+typedef struct uthread_cond *uthread_cond_t;
+
+/*
+ * uthread_cond_create - Create condition variable
+ *
+ * Allocate and initialize a condition variable with no waiters.
+ *
+ * Return: Pointer to initialized condition variable. NULL in case of failure
+ * when allocating the new condition variable.
+ */
+uthread_cond_t uthread_cond_create(void);
+
+/*
+ * uthread_cond_destroy - Deallocate a condition variable
+ * @cond: Condition variable to deallocate
+ *
+ * Deallocate condition variable @cond. A thread counts as waiting on @cond
+ * until it has found out why it was woken up, which happens on its way out of
+ * uthread_cond_wait(), before it takes the mutex back.
+ *
+ * Return: -1 if @cond is NULL or if threads are still waiting on @cond. 0 if
+ * @cond was successfully destroyed.
+ */
+int uthread_cond_destroy(uthread_cond_t cond);
+
+/*
+ * uthread_cond_wait - Wait on a condition variable
+ * @cond: Condition variable to wait on
+ * @mutex: Mutex owned by the caller, protecting the condition
+ *
+ * Atomically release @mutex and block the calling thread until @cond is
+ * signaled, then take @mutex again before returning. The thread may also
+ * return without @cond being signaled, and must check the condition again.
+ *
+ * Return: -1 if @cond or @mutex is NULL, or if @mutex is not owned by the
+ * calling thread. 0 once @mutex is locked again.
+ */
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_timedwait - Wait on a condition variable for a bounded time
+ * @cond: Condition variable to wait on
+ * @mutex: Mutex owned by the caller, protecting the condition
+ * @timeout: Time to wait for at most, in microseconds
+ *
+ * Same as uthread_cond_wait(), but the thread stops waiting once @timeout has
+ * elapsed, and takes @mutex again. Timeouts are served by the workers when
+ * they switch threads or are idle: a thread running alone on its worker
+ * without yielding nor blocking delays them.
+ *
+ * Return: -1 if @cond or @mutex is NULL, if @mutex is not owned by the calling
+ * thread or if @timeout is negative. 1 if @timeout elapsed before @cond was
+ * signaled, 0 otherwise, once @mutex is locked again.
+ */
+int uthread_cond_timedwait(uthread_cond_t cond, uthread_mutex_t mutex,
+			   long timeout);
+
+/*
+ * uthread_cond_signal - Signal a condition variable
+ * @cond: Condition variable to signal
+ *
+ * Unblock the first thread (i.e. the oldest) waiting on @cond, if any.
+ *
+ * Return: -1 if @cond is NULL. 0 if @cond was successfully signaled.
+ */
+int uthread_cond_signal(uthread_cond_t cond);
+
+/*
+ * uthread_cond_broadcast - Signal a condition variable to all its waiters
+ * @cond: Condition variable to signal
+ *
+ * Unblock all the threads waiting on @cond. They are moved to the waiting
+ * queue of their mutex in constant time, however many they are.
+ *
+ * Return: -1 if @cond is NULL. 0 if @cond was successfully signaled.
+ */
+int uthread_cond_broadcast(uthread_cond_t cond);
+
+#endif /* _MUTEX_H */
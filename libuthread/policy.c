@@ -0,0 +1,339 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uthread.h"
+#include "policy.h"
+#include "heap.h"
+#include "queue.h"
+#include "rqueue.h"
+
+// Priority levels
+// =============================================================================
+// Each worker has a ready queue per priority level, either an intrusive list
+// or, when built with READY_QUEUE=ring, a ring buffer of thread pointers. A
+// bitmap of the non-empty levels finds the highest priority ready thread with a
+// single bit scan.
+struct fifo_worker {
+#ifdef UTHREAD_READY_RING
+    rqueue_t     queues[UTHREAD_PRIORITIES];
+#else
+    iqueue_t     queues[UTHREAD_PRIORITIES];
+#endif
+    unsigned int levels; // Bit i set if level i has ready threads
+};
+
+int fifo_init(void *worker) {
+    struct fifo_worker *fifo = worker;
+    for (int level = 0; level < UTHREAD_PRIORITIES; level++) {
+#ifdef UTHREAD_READY_RING
+        fifo->queues[level] = rqueue_create();
+        if (fifo->queues[level] == NULL) {
+            // ERROR: Failed to create ready queue
+            while (level-- > 0) {
+                rqueue_destroy(fifo->queues[level]);
+                fifo->queues[level] = NULL;
+            }
+            return -1;
+        }
+#else
+        iqueue_init(&(fifo->queues[level]));
+#endif
+    }
+    return 0;
+}
+
+void fifo_destroy(void *worker) {
+#ifdef UTHREAD_READY_RING
+    struct fifo_worker *fifo = worker;
+    for (int level = 0; level < UTHREAD_PRIORITIES; level++) {
+        rqueue_destroy(fifo->queues[level]);
+        fifo->queues[level] = NULL;
+    }
+#else
+    (void)worker;
+#endif
+}
+
+void fifo_enqueue(void *worker, struct uthread_sched *thread) {
+    struct fifo_worker *fifo = worker;
+    int level = thread->level;
+#ifdef UTHREAD_READY_RING
+    if (rqueue_enqueue(fifo->queues[level], thread) < 0) {
+        // ERROR: Failed to grow the ready queue, the thread would be lost
+        perror("rqueue_enqueue");
+        exit(1);
+    }
+#else
+    iqueue_enqueue(&(fifo->queues[level]), &(thread->link));
+#endif
+    fifo->levels |= 1u << level;
+}
+
+// Oldest thread of the highest priority level, no lower than the level of
+// @current when given
+struct uthread_sched *fifo_pick_next(void *worker,
+        struct uthread_sched *current, bool steal) {
+    struct fifo_worker *fifo = worker;
+    int max_level = current != NULL ? current->level : UTHREAD_PRIORITIES - 1;
+    unsigned int levels = fifo->levels & ((2u << max_level) - 1);
+    if (levels == 0) {
+        return NULL;
+    }
+
+    int level = __builtin_ctz(levels);
+    struct uthread_sched *thread;
+#ifdef UTHREAD_READY_RING
+    rqueue_peek(fifo->queues[level], (void**)&thread);
+    if (steal && thread->pinned) {
+        return NULL;
+    }
+    rqueue_dequeue(fifo->queues[level], (void**)&thread);
+    bool empty = rqueue_length(fifo->queues[level]) == 0;
+#else
+    thread = iqueue_entry(fifo->queues[level].head, struct uthread_sched,
+        link);
+    if (steal && thread->pinned) {
+        return NULL;
+    }
+    queue_link_t *link;
+    iqueue_dequeue(&(fifo->queues[level]), &link);
+    bool empty = fifo->queues[level].head == NULL;
+#endif
+    if (empty) {
+        fifo->levels &= ~(1u << level);
+    }
+    return thread;
+}
+
+// A thread woken up with a higher priority runs right away
+bool fifo_on_wake(void *worker, struct uthread_sched *thread,
+        struct uthread_sched *current) {
+    (void)worker;
+    return current != NULL && thread->level < current->level;
+}
+
+const uthread_policy_t uthread_policy_fifo = {
+    .name = "fifo",
+    .worker_size = sizeof(struct fifo_worker),
+    .init = fifo_init,
+    .destroy = fifo_destroy,
+    .enqueue = fifo_enqueue,
+    .pick_next = fifo_pick_next,
+    .on_wake = fifo_on_wake,
+};
+
+// Multilevel feedback queue
+// =============================================================================
+// The priority levels of uthread_policy_fifo, with the level of each thread
+// following its behavior
+
+// A thread that used up its time slice is demoted
+void mlfq_on_tick(void *worker, struct uthread_sched *current) {
+    (void)worker;
+    if (current->slice_ticks >= 1 && current->level < UTHREAD_PRIORITIES - 1) {
+        ++(current->level);
+    }
+}
+
+// A thread blocking before using up its time slice gets back one of the levels
+// it was demoted by
+void mlfq_on_block(void *worker, struct uthread_sched *thread) {
+    (void)worker;
+    if (thread->slice_ticks < 1 && thread->level > thread->priority) {
+        --(thread->level);
+    }
+}
+
+const uthread_policy_t uthread_policy_mlfq = {
+    .name = "mlfq",
+    .worker_size = sizeof(struct fifo_worker),
+    .init = fifo_init,
+    .destroy = fifo_destroy,
+    .enqueue = fifo_enqueue,
+    .pick_next = fifo_pick_next,
+    .on_block = mlfq_on_block,
+    .on_wake = fifo_on_wake,
+    .on_tick = mlfq_on_tick,
+};
+
+// Weighted fair share
+// =============================================================================
+// The key of a thread is its virtual runtime, in nanoseconds: the time it ran,
+// as accounted by the scheduler, scaled down by its weight. Each worker keeps
+// its ready threads in a heap by virtual runtime, along with the minimum
+// virtual runtime where threads joining it are placed. While a thread is
+// neither ready nor running, its virtual runtime is kept relative to the
+// minimum of the worker it left, as virtual runtimes of different workers do
+// not compare.
+struct fair_worker {
+    iheap_t         heap; // Ready threads by virtual runtime
+    _Atomic int     ready; // Length of heap, read without the lock by on_wake
+    _Atomic int64_t min_vruntime; // Also advanced without the lock by on_wake
+};
+
+// Order threads by virtual runtime
+int fair_cmp(const heap_link_t *a, const heap_link_t *b) {
+    int64_t vruntime_a = iheap_entry(a, struct uthread_sched, heap_link)->key;
+    int64_t vruntime_b = iheap_entry(b, struct uthread_sched, heap_link)->key;
+    return (vruntime_a > vruntime_b) - (vruntime_a < vruntime_b);
+}
+
+// Charge a thread for the time it ran since it was last charged
+void fair_charge(struct uthread_sched *thread) {
+    thread->key += thread->runtime * UTHREAD_WEIGHT_DEFAULT / thread->weight;
+    thread->runtime = 0;
+}
+
+// Threads are placed no earlier than the ones already picked, or than the one
+// running alone. The minimum only ever moves forward, even with on_wake
+// advancing it without the lock while pick_next does under it.
+void fair_advance(struct fair_worker *fair, int64_t vruntime) {
+    int64_t min_vruntime = atomic_load_explicit(&(fair->min_vruntime),
+        memory_order_relaxed);
+    while (vruntime > min_vruntime && !atomic_compare_exchange_weak_explicit(
+            &(fair->min_vruntime), &min_vruntime, vruntime,
+            memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// Make the virtual runtime of a thread leaving a worker relative to the
+// worker's minimum
+void fair_lag(struct fair_worker *fair, struct uthread_sched *thread) {
+    thread->key -= atomic_load_explicit(&(fair->min_vruntime),
+        memory_order_relaxed);
+}
+
+int fair_init(void *worker) {
+    struct fair_worker *fair = worker;
+    iheap_init(&(fair->heap), fair_cmp);
+    atomic_init(&(fair->ready), 0);
+    atomic_init(&(fair->min_vruntime), 0);
+    return 0;
+}
+
+void fair_enqueue(void *worker, struct uthread_sched *thread) {
+    struct fair_worker *fair = worker;
+    fair_charge(thread);
+    iheap_insert(&(fair->heap), &(thread->heap_link));
+    atomic_fetch_add_explicit(&(fair->ready), 1, memory_order_relaxed);
+}
+
+// Thread with the smallest virtual runtime, smaller than the one of @current
+// when given. A thread is only stolen by a worker with nothing else to run.
+struct uthread_sched *fair_pick_next(void *worker,
+        struct uthread_sched *current, bool steal) {
+    struct fair_worker *fair = worker;
+    if (steal && current != NULL) {
+        return NULL;
+    }
+    if (current != NULL) {
+        fair_charge(current);
+    }
+
+    heap_link_t *link;
+    if (iheap_peek(&(fair->heap), &link) < 0) {
+        if (current != NULL) {
+            fair_advance(fair, current->key);
+        }
+        return NULL;
+    }
+    struct uthread_sched *thread =
+        iheap_entry(link, struct uthread_sched, heap_link);
+    if ((current != NULL && thread->key >= current->key)
+            || (steal && thread->pinned)) {
+        return NULL;
+    }
+
+    iheap_pop(&(fair->heap), &link);
+    atomic_fetch_sub_explicit(&(fair->ready), 1, memory_order_relaxed);
+    fair_advance(fair, thread->key);
+    if (steal) {
+        fair_lag(fair, thread);
+    }
+    return thread;
+}
+
+void fair_on_block(void *worker, struct uthread_sched *thread) {
+    fair_charge(thread);
+    fair_lag(worker, thread);
+}
+
+// Place a thread joining a worker at the worker's minimum, plus what it ran
+// ahead of the others. Credit for the time spent blocked is not kept: a thread
+// that was away long does not get to starve the others. Woken up threads never
+// preempt the current one, which gets to finish its time slice. The heap is
+// not touched without the lock: a thief taking the last ready thread in the
+// meantime only makes the current thread count as running alone a bit late.
+bool fair_on_wake(void *worker, struct uthread_sched *thread,
+        struct uthread_sched *current) {
+    struct fair_worker *fair = worker;
+    if (current != NULL) {
+        // Running alone so far, the current thread is where the minimum is
+        fair_charge(current);
+        if (atomic_load_explicit(&(fair->ready), memory_order_relaxed) == 0) {
+            fair_advance(fair, current->key);
+        }
+    }
+
+    thread->key = (thread->key > 0 ? thread->key : 0)
+        + atomic_load_explicit(&(fair->min_vruntime), memory_order_relaxed);
+    return false;
+}
+
+const uthread_policy_t uthread_policy_fair = {
+    .name = "fair",
+    .worker_size = sizeof(struct fair_worker),
+    .account = true,
+    .init = fair_init,
+    .enqueue = fair_enqueue,
+    .pick_next = fair_pick_next,
+    .on_block = fair_on_block,
+    .on_wake = fair_on_wake,
+};
+
+// Last in first out
+// =============================================================================
+// Each worker keeps its ready threads in a single intrusive list, running the
+// newest. Other workers steal the oldest one instead, which is the least
+// likely to have anything left in the caches of its worker.
+struct lifo_worker {
+    iqueue_t stack;
+};
+
+int lifo_init(void *worker) {
+    struct lifo_worker *lifo = worker;
+    iqueue_init(&(lifo->stack));
+    return 0;
+}
+
+void lifo_enqueue(void *worker, struct uthread_sched *thread) {
+    struct lifo_worker *lifo = worker;
+    iqueue_enqueue(&(lifo->stack), &(thread->link));
+}
+
+struct uthread_sched *lifo_pick_next(void *worker,
+        struct uthread_sched *current, bool steal) {
+    struct lifo_worker *lifo = worker;
+    (void)current;
+    queue_link_t *link = steal ? lifo->stack.head : lifo->stack.tail;
+    if (link == NULL) {
+        return NULL;
+    }
+
+    struct uthread_sched *thread =
+        iqueue_entry(link, struct uthread_sched, link);
+    if (steal && thread->pinned) {
+        return NULL;
+    }
+    iqueue_remove(&(lifo->stack), link);
+    return thread;
+}
+
+const uthread_policy_t uthread_policy_lifo = {
+    .name = "lifo",
+    .worker_size = sizeof(struct lifo_worker),
+    .init = lifo_init,
+    .enqueue = lifo_enqueue,
+    .pick_next = lifo_pick_next,
+};
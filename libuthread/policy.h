@@ -0,0 +1,135 @@
+#ifndef _POLICY_H
+#define _POLICY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "heap.h"
+#include "queue.h"
+
+/*
+ * uthread_sched - Scheduling data of a thread
+ * @link: Link for the policy to keep the thread in an intrusive queue while it
+ *	is ready
+ * @heap_link: Link for the policy to keep the thread in an intrusive heap
+ *	while it is ready
+ * @priority: Base priority level, set with uthread_attr_setpriority() or
+ *	uthread_set_priority()
+ * @level: Current priority level, which the policy may move away from
+ *	@priority
+ * @weight: Weight, set with uthread_attr_setweight() or uthread_set_weight()
+ * @pinned: The thread must not be stolen by another worker
+ * @slice_ticks: Preemption ticks since the thread started a whole time slice:
+ *	it starts at 0 when switched to on a tick, at -1 when switched to in the
+ *	middle of a time slice
+ * @runtime: Time the thread ran that the policy has yet to account for, in
+ *	nanoseconds, when the policy asks for it (see uthread_policy_t). The
+ *	policy resets it as it accounts for it.
+ * @key: Free for the policy, 0 for a new thread
+ */
+struct uthread_sched {
+	queue_link_t link;
+	heap_link_t heap_link;
+	int priority;
+	int level;
+	int weight;
+	bool pinned;
+	int slice_ticks;
+	int64_t runtime;
+	int64_t key;
+};
+
+/*
+ * uthread_policy_t - Scheduling policy
+ * @name: Name of the policy
+ * @worker_size: Size of the data the policy keeps for each worker, allocated
+ *	and zeroed by the library
+ * @account: Keep the @runtime of the threads up to date, reading the monotonic
+ *	clock at every switch
+ * @init: Initialize the data of a worker, returning -1 on failure (optional)
+ * @destroy: Release the data of a worker, whose threads are all gone
+ *	(optional)
+ * @enqueue: Make @thread ready on the worker
+ * @pick_next: Remove and return the next ready thread to run on the worker,
+ *	NULL if there is none. When @current is not NULL, it is the running
+ *	thread, which stays ready: only return a thread that should run instead.
+ *	When @steal is true, the thread goes to another worker, which calls
+ *	@on_wake for it: only return one that is not pinned.
+ * @on_block: @thread, which was running on the worker, blocked (optional)
+ * @on_wake: @thread becomes runnable on the worker, after being created,
+ *	unblocked or stolen, and is enqueued right after. @current is the
+ *	running thread of the worker when that thread is the one making @thread
+ *	runnable, NULL otherwise. Returns whether @thread should run right away
+ *	instead of @current (optional)
+ * @on_tick: @current, the running thread of the worker, got a preemption tick
+ *	and is about to be switched out if another ready thread should run
+ *	instead (optional)
+ *
+ * A policy decides which thread each worker runs next, from the hooks the
+ * scheduler calls as threads become ready, block, wake up and get ticks. The
+ * data of a worker is handed to every hook as @worker. Ready threads with a
+ * deadline (see uthread_set_deadline()) are kept by the scheduler itself and
+ * run before the threads of the policy.
+ *
+ * @enqueue and @pick_next are called with the lock of the worker held, the
+ * other hooks without it. Any worker may call @enqueue, @pick_next and @on_wake
+ * for another, while @on_block and @on_tick are only called by the worker
+ * itself. No hook may block or switch threads.
+ */
+typedef struct uthread_policy {
+	const char *name;
+	size_t worker_size;
+	bool account;
+	int (*init)(void *worker);
+	void (*destroy)(void *worker);
+	void (*enqueue)(void *worker, struct uthread_sched *thread);
+	struct uthread_sched *(*pick_next)(void *worker,
+					   struct uthread_sched *current,
+					   bool steal);
+	void (*on_block)(void *worker, struct uthread_sched *thread);
+	bool (*on_wake)(void *worker, struct uthread_sched *thread,
+			struct uthread_sched *current);
+	void (*on_tick)(void *worker, struct uthread_sched *current);
+} uthread_policy_t;
+
+/*
+ * uthread_policy_fifo - Priority levels, first in first out within a level
+ *
+ * The default policy. A worker runs the oldest ready thread of the highest
+ * priority level, and a running thread only makes way for threads of at least
+ * its priority. A thread woken up with a higher priority than the running
+ * thread runs right away.
+ */
+extern const uthread_policy_t uthread_policy_fifo;
+
+/*
+ * uthread_policy_mlfq - Multilevel feedback queue
+ *
+ * Same as uthread_policy_fifo, but a thread that used up a whole time slice
+ * is demoted by one priority level on the tick, and a thread that blocks
+ * before the end of its time slice is promoted by one level, never above its
+ * own priority.
+ */
+extern const uthread_policy_t uthread_policy_mlfq;
+
+/*
+ * uthread_policy_fair - Weighted fair share
+ *
+ * Each thread has a virtual runtime, the time it ran scaled by
+ * UTHREAD_WEIGHT_DEFAULT over its weight, and a worker runs the ready thread
+ * with the smallest one. Priorities are ignored.
+ */
+extern const uthread_policy_t uthread_policy_fair;
+
+/*
+ * uthread_policy_lifo - Last in first out
+ *
+ * A worker runs the thread made ready last, whose data is the most likely to
+ * still be in the caches. Priorities are ignored. The threads made ready first
+ * may never run while others keep coming, so this suits threads that block
+ * rather than yield.
+ */
+extern const uthread_policy_t uthread_policy_lifo;
+
+#endif /* _POLICY_H */
@@ -1,94 +1,281 @@
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
 
-/*
- * Frequency of preemption
- * 100Hz is 100 times per second
- */
-#define HZ 100
 #define ONE_SECOND_MICRO_SECONDS 1000000
 
-struct itimerval timer;
-struct itimerval prev_timer;
+// Older C libraries do not name the target thread field of struct sigevent
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// The signal handler is process-wide: it is set up by the first kernel thread
+// starting preemption, and restored by the last one stopping it. Each kernel
+// thread starting preemption gets its own timer, whose alarms are delivered to
+// it only, so that the other threads of the process are never interrupted and
+// each scheduler instance has its own time slices.
 struct sigaction sa;
+struct sigaction prev_sa;
 sigset_t ss;
+pthread_mutex_t preempt_lock = PTHREAD_MUTEX_INITIALIZER;
+int preempt_users = 0;
+__thread bool preempt_active = false;
+
+// Critical sections are tracked per kernel thread, in flags that only the
+// kernel thread itself and its signal handler touch, instead of by blocking the
+// alarm with a syscall. An alarm hitting a critical section is recorded as
+// pending and served when the section closes.
+// They are only ever accessed directly, never through a pointer: a thread may
+// be preempted and resumed on another kernel thread between the computation of
+// the address of a thread-local variable and its access.
+__thread volatile sig_atomic_t preempt_disabled = 0;
+__thread volatile sig_atomic_t preempt_pending = 0;
 
 // Signal handler for timer
 void preempt_handler() {
-    uthread_yield();
+    // The alarm may hit a kernel thread that runs no preemptive scheduler
+    if (!preempt_active) {
+        return;
+    }
+
+    // Defer the yield to the end of the critical section
+    if (preempt_disabled) {
+        preempt_pending = 1;
+        return;
+    }
+    uthread_preempt();
 }
 
 void preempt_disable(void) {
-    // Block timer alarm
-    sigprocmask(SIG_BLOCK, &ss, NULL);
+    preempt_disabled = 1;
+    // Keep the critical section after the flag is raised
+    atomic_signal_fence(memory_order_seq_cst);
 }
 
 void preempt_enable(void) {
-    // Unblock timer alarm
-    sigprocmask(SIG_UNBLOCK, &ss, NULL);
+    // Keep the critical section before the flag is cleared
+    atomic_signal_fence(memory_order_seq_cst);
+    preempt_disabled = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+
+    // Serve an alarm that hit the critical section
+    if (preempt_pending) {
+        preempt_pending = 0;
+        uthread_preempt();
+    }
+}
+
+/*
+ * preempt_unblock - Let alarms in again from the signal handler
+ *
+ * To be called, with preemption disabled, before switching threads from the
+ * signal handler, which runs with the alarm blocked. An alarm coming in after
+ * that is only recorded as pending until preemption is enabled again.
+ */
+void preempt_unblock(void) {
+    pthread_sigmask(SIG_UNBLOCK, &ss, NULL);
+}
+
+// Make @timer fire every time slice while its kernel thread needs ticks, and
+// stop it otherwise (timer lock held)
+void preempt_arm(preempt_timer_t *timer) {
+    bool ticking = atomic_load(&(timer->ticking));
+    if (!timer->created || ticking == timer->armed) {
+        return;
+    }
+
+    struct itimerspec timer_spec;
+    long quantum = ticking ? timer->quantum : 0;
+    timer_spec.it_value.tv_sec = quantum / ONE_SECOND_MICRO_SECONDS;
+    timer_spec.it_value.tv_nsec = quantum % ONE_SECOND_MICRO_SECONDS * 1000;
+    timer_spec.it_interval = timer_spec.it_value;
+    if (timer_settime(timer->id, 0, &timer_spec, NULL) == 0) {
+        timer->armed = ticking;
+    }
+}
+
+/*
+ * preempt_timer_init - Initialize a preemption timer
+ * @timer: Timer to initialize
+ * @quantum: Length of a time slice in microseconds
+ *
+ * The timer is only created by preempt_start(), on the kernel thread it then
+ * targets.
+ */
+void preempt_timer_init(preempt_timer_t *timer, long quantum) {
+    pthread_mutex_init(&(timer->lock), NULL);
+    timer->created = false;
+    timer->armed = false;
+    timer->quantum = quantum;
+    atomic_store(&(timer->ticking), false);
 }
 
 /*
  * preempt_start - Start thread preemption
  * @preempt: Enable preemption if true
+ * @clock: Clock measuring the time slices
+ * @timer: Preemption timer of the calling kernel thread
  *
- * Configure a timer that must fire a virtual alarm at a frequency of 100 Hz and
- * setup a timer handler that forcefully yields the currently running thread.
+ * Create @timer on @clock, targeting the calling kernel thread, so that it
+ * fires an alarm every time slice while threads wait for the CPU (see
+ * preempt_tick_get()). Setup a timer handler that forcefully yields the
+ * currently running thread.
+ *
+ * With CLOCK_PROCESS_CPUTIME_ID, the timer of every kernel thread counts the
+ * CPU time of the whole process, including that of unrelated pthreads, so a
+ * slice gets shorter the more threads of the process are running.
  *
  * If @preempt is false, don't start preemption; all the other functions from
  * the preemption API should then be ineffective.
+ *
+ * Preemption is started for the calling kernel thread only, and is left
+ * disabled for it and for the kernel threads it creates afterwards: it only
+ * gets enabled once a thread is switched to. The signal handler is shared by
+ * all the kernel threads that started preemption.
  */
-void preempt_start(bool preempt) {
+void preempt_start(bool preempt, clockid_t clock, preempt_timer_t *timer) {
     if (preempt == false) {
         return;
     }
 
-    // SIGVTALRM signal handler
-    sa.sa_handler = preempt_handler;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask);
-    sigaction(SIGVTALRM, &sa, NULL);
-
     // Sig set (For signal blocking)
     sigemptyset(&ss);
     sigaddset(&ss, SIGVTALRM);
 
-    // Timer lifetime
-    int frequency = ONE_SECOND_MICRO_SECONDS / HZ; // HZ to milliseconds
-    timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = frequency;
-    // Timer interval
-    timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = frequency;
+    // Start disabled, the first thread switched to enables preemption
+    preempt_disabled = 1;
+    preempt_pending = 0;
+    pthread_sigmask(SIG_UNBLOCK, &ss, NULL);
 
-    // Get previous timer settings
-    getitimer(ITIMER_VIRTUAL, &prev_timer);
+    pthread_mutex_lock(&preempt_lock);
+    if (preempt_users == 0) {
+        // SIGVTALRM signal handler
+        // The alarm stays blocked while the handler runs, so that alarms
+        // coming in before it could raise the critical section flag do not
+        // stack signal frames without limit. The handler may switch threads and
+        // not return for a while: preempt_unblock() lets alarms in again then.
+        sa.sa_handler = preempt_handler;
+        sa.sa_flags = 0;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGVTALRM, &sa, &prev_sa);
+    }
+    ++preempt_users;
+    pthread_mutex_unlock(&preempt_lock);
+
+    // Timer raising SIGVTALRM on this kernel thread only
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGVTALRM;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    pthread_mutex_lock(&(timer->lock));
+    if (timer_create(clock, &sev, &(timer->id)) == -1) {
+        // ERROR: Failed to create timer, the threads will not be preempted
+        pthread_mutex_unlock(&(timer->lock));
+    } else {
+        // Periodic expiry every time slice, once ticks are needed
+        timer->created = true;
+        preempt_arm(timer);
+        pthread_mutex_unlock(&(timer->lock));
+    }
+    preempt_active = true;
+}
 
-    // Set a new timer
-    if (setitimer(ITIMER_VIRTUAL, &timer, NULL) == -1) {
-        // ERROR: Failed to initialize timer
+/*
+ * preempt_set_quantum - Change the length of time slices
+ * @timer: Preemption timer to change
+ * @quantum: Length of a time slice in microseconds
+ *
+ * The new time slice starts from now if the timer is running.
+ */
+void preempt_set_quantum(preempt_timer_t *timer, long quantum) {
+    pthread_mutex_lock(&(timer->lock));
+    timer->quantum = quantum;
+    if (timer->armed) {
+        // Re-arm with the new time slice
+        timer->armed = false;
+        preempt_arm(timer);
+    }
+    pthread_mutex_unlock(&(timer->lock));
+}
+
+/*
+ * preempt_tick_get - Need timer ticks
+ * @timer: Preemption timer of the kernel thread
+ *
+ * To be called, with preemption disabled, when threads start waiting for the
+ * CPU on a kernel thread using preemption, possibly from another kernel thread.
+ * The timer runs until preempt_tick_put().
+ */
+void preempt_tick_get(preempt_timer_t *timer) {
+    if (atomic_load(&(timer->ticking))
+            || atomic_exchange(&(timer->ticking), true)) {
         return;
     }
+
+    pthread_mutex_lock(&(timer->lock));
+    preempt_arm(timer);
+    pthread_mutex_unlock(&(timer->lock));
+}
+
+/*
+ * preempt_tick_put - Stop needing timer ticks
+ * @timer: Preemption timer of the kernel thread
+ *
+ * To be called, with preemption disabled, when there are no threads waiting for
+ * the CPU anymore. The timer stops until preempt_tick_get().
+ */
+void preempt_tick_put(preempt_timer_t *timer) {
+    if (!atomic_load_explicit(&(timer->ticking), memory_order_relaxed)
+            || !atomic_exchange(&(timer->ticking), false)) {
+        return;
+    }
+
+    pthread_mutex_lock(&(timer->lock));
+    preempt_arm(timer);
+    pthread_mutex_unlock(&(timer->lock));
 }
 
 /*
  * preempt_stop - Stop thread preemption
+ * @timer: Preemption timer of the calling kernel thread
  *
- * Restore previous timer configuration, and previous action associated to
- * virtual alarm signals.
+ * Stop preemption for the calling kernel thread and delete @timer. Once no
+ * kernel thread uses preemption anymore, restore the previous action
+ * associated to alarm signals.
  */
-void preempt_stop(void) {
-    // Revert signal handler to default signal
-    sa.sa_handler = SIG_DFL;
-    sigaction(SIGVTALRM, &sa, NULL);
-    // Revert timer to previous config
-    setitimer(ITIMER_VIRTUAL, &prev_timer, NULL);
-}
\ No newline at end of file
+void preempt_stop(preempt_timer_t *timer) {
+    if (!preempt_active) {
+        return;
+    }
+    preempt_active = false;
+
+    // Stop and free the timer
+    pthread_mutex_lock(&(timer->lock));
+    if (timer->created) {
+        timer_delete(timer->id);
+        timer->created = false;
+        timer->armed = false;
+    }
+    pthread_mutex_unlock(&(timer->lock));
+
+    pthread_mutex_lock(&preempt_lock);
+    if (--preempt_users == 0) {
+        // Revert signal handler to previous action
+        sigaction(SIGVTALRM, &prev_sa, NULL);
+    }
+    pthread_mutex_unlock(&preempt_lock);
+}
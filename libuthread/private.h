@@ -10,8 +10,18 @@
 /**
  * Private context API
  */
+#ifdef UTHREAD_CTX_UCONTEXT
 #include <ucontext.h>
+#endif
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "queue.h"
 #include "uthread.h"
 
 /*
@@ -23,8 +33,18 @@
  * Such a context is initialized for the first time when creating a thread with
  * uthread_ctx_init(). Once initialized, it can be switched to with
  * uthread_ctx_switch().
+ *
+ * The default backend (switch_<arch>.S) only keeps the saved stack pointer, as
+ * the callee-saved registers are pushed onto the thread's own stack. Building
+ * with UTHREAD_CTX_UCONTEXT falls back to the portable ucontext_t backend.
  */
+#ifdef UTHREAD_CTX_UCONTEXT
 typedef ucontext_t uthread_ctx_t;
+#else
+typedef struct uthread_ctx {
+	void *sp;
+} uthread_ctx_t;
+#endif
 
 /*
  * uthread_ctx_switch - Switch between two execution contexts
@@ -34,69 +54,266 @@ typedef ucontext_t uthread_ctx_t;
  */
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next);
 
+/*
+ * uthread_ctx_stack_size - Round a requested stack size
+ * @size: Requested size of the stack segment, in bytes (0 for the default size)
+ *
+ * Return: The size that uthread_ctx_alloc_stack() would actually provide for
+ * @size, i.e. @size rounded up to a whole number of pages
+ */
+size_t uthread_ctx_stack_size(size_t size);
+
 /*
  * uthread_ctx_alloc_stack - Allocate stack segment
+ * @size: Size of the stack segment, as returned by uthread_ctx_stack_size()
+ *
+ * The segment is mapped right above an inaccessible guard page, so that a
+ * thread overflowing its stack faults instead of corrupting memory. Pages are
+ * only committed by the kernel once touched.
  *
  * Return: Pointer to the top of a valid stack segment, or NULL in case of
  * failure
  */
-void *uthread_ctx_alloc_stack(void);
+void *uthread_ctx_alloc_stack(size_t size);
 
 /*
  * uthread_ctx_destroy_stack - Deallocate stack segment
  * @top_of_stack: Address of stack to deallocate
+ * @size: Size the stack was allocated with
+ */
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size);
+
+/*
+ * uthread_ctx_paint_stack - Paint a stack segment with a canary pattern
+ * @top_of_stack: Pointer to the top of a stack segment
+ * @size: Size of the stack segment
+ * @depth: Number of bytes to paint, starting from the end of the segment where
+ *	the stack starts growing from
+ *
+ * Painting a whole stack commits all of its pages.
+ */
+void uthread_ctx_paint_stack(void *top_of_stack, size_t size, size_t depth);
+
+/*
+ * uthread_ctx_stack_depth - Measure the peak usage of a painted stack
+ * @top_of_stack: Pointer to the top of a stack segment
+ * @size: Size of the stack segment
+ *
+ * Return: Number of bytes of the stack segment that have been written to
+ * since it was painted by uthread_ctx_paint_stack()
  */
-void uthread_ctx_destroy_stack(void *top_of_stack);
+size_t uthread_ctx_stack_depth(void *top_of_stack, size_t size);
 
 /*
  * uthread_ctx_init - Initialize a thread's execution context
  * @uctx: Pointer to thread context to initialize
  * @top_of_stack: Pointer to the top of a valid stack segment, as allocated by
  *	uthread_ctx_alloc_stack()
+ * @size: Size of the stack segment
  * @func: Function to be executed by the thread
  * @arg: Argument to pass to the thread
  *
  * Return: 0 if @uctx was properly initialized, or -1 in case of failure
  */
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
 					 uthread_func_t func, void *arg);
 
+/*
+ * uthread_ctx_init_raw - Initialize an internal execution context
+ * @uctx: Pointer to context to initialize
+ * @top_of_stack: Pointer to the top of a valid stack segment
+ * @size: Size of the stack segment
+ * @func: Function to be executed by the context
+ * @arg: Argument to pass to @func
+ *
+ * Same as uthread_ctx_init(), except that @func is called directly: preemption
+ * is left disabled when the context first runs, and @func must never return.
+ * This is meant for contexts used internally by the library, which are only
+ * ever switched to with preemption disabled.
+ *
+ * Return: 0 if @uctx was properly initialized, or -1 in case of failure
+ */
+int uthread_ctx_init_raw(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
+						 uthread_func_t func, void *arg);
+
+/*
+ * uthread_ctx_stack_pointer - Get the stack pointer of a saved context
+ * @uctx: Context that was saved by uthread_ctx_switch()
+ *
+ * Everything of the context's stack below the returned address is free.
+ *
+ * Return: Saved stack pointer, or NULL if the backend cannot tell
+ */
+void *uthread_ctx_stack_pointer(uthread_ctx_t *uctx);
+
 
 /**
  * Private preemption API
  */
 
+/*
+ * preempt_timer_t - Preemption timer of a kernel thread
+ *
+ * Fires alarms at the kernel thread it was created for only, every time slice
+ * while the kernel thread needs ticks. Other kernel threads may start and stop
+ * the ticks, and change the time slice.
+ */
+typedef struct preempt_timer {
+	pthread_mutex_t lock;
+	timer_t id;
+	bool created;
+	bool armed;
+	long quantum;
+	atomic_bool ticking;
+} preempt_timer_t;
+
+/*
+ * preempt_timer_init - Initialize a preemption timer
+ * @timer: Timer to initialize
+ * @quantum: Length of a time slice in microseconds
+ *
+ * The timer is only created by preempt_start(), on the kernel thread it then
+ * targets.
+ */
+void preempt_timer_init(preempt_timer_t *timer, long quantum);
+
 /*
  * preempt_start - Start thread preemption
  * @preempt: Enable preemption if true
+ * @clock: Clock measuring the time slices
+ * @timer: Preemption timer of the calling kernel thread
  *
- * Configure a timer that must fire a virtual alarm at a frequency of 100 Hz and
- * setup a timer handler that forcefully yields the currently running thread.
+ * Create @timer on @clock, targeting the calling kernel thread, so that it
+ * fires an alarm every time slice while threads wait for the CPU (see
+ * preempt_tick_get()). Setup a timer handler that forcefully yields the
+ * currently running thread.
+ *
+ * With CLOCK_PROCESS_CPUTIME_ID, the timer of every kernel thread counts the
+ * CPU time of the whole process, including that of unrelated pthreads, so a
+ * slice gets shorter the more threads of the process are running.
  *
  * If @preempt is false, don't start preemption; all the other functions from
  * the preemption API should then be ineffective.
+ *
+ * Preemption is started for the calling kernel thread only, and is left
+ * disabled for it and for the kernel threads it creates afterwards: it only
+ * gets enabled once a thread is switched to. The signal handler is shared by
+ * all the kernel threads that started preemption.
  */
-void preempt_start(bool preempt);
+void preempt_start(bool preempt, clockid_t clock, preempt_timer_t *timer);
 
 /*
  * preempt_stop - Stop thread preemption
+ * @timer: Preemption timer of the calling kernel thread
+ *
+ * Stop preemption for the calling kernel thread and delete @timer. Once no
+ * kernel thread uses preemption anymore, restore the previous action
+ * associated to alarm signals.
+ */
+void preempt_stop(preempt_timer_t *timer);
+
+/*
+ * preempt_set_quantum - Change the length of time slices
+ * @timer: Preemption timer to change
+ * @quantum: Length of a time slice in microseconds
+ *
+ * The new time slice starts from now if the timer is running.
+ */
+void preempt_set_quantum(preempt_timer_t *timer, long quantum);
+
+/*
+ * preempt_tick_get - Need timer ticks
+ * @timer: Preemption timer of the kernel thread
+ *
+ * To be called, with preemption disabled, when threads start waiting for the
+ * CPU on a kernel thread using preemption, possibly from another kernel thread.
+ * The timer runs until preempt_tick_put().
+ */
+void preempt_tick_get(preempt_timer_t *timer);
+
+/*
+ * preempt_tick_put - Stop needing timer ticks
+ * @timer: Preemption timer of the kernel thread
  *
- * Restore previous timer configuration, and previous action associated to
- * virtual alarm signals.
+ * To be called, with preemption disabled, when there are no threads waiting for
+ * the CPU anymore. The timer stops until preempt_tick_get().
  */
-void preempt_stop(void);
+void preempt_tick_put(preempt_timer_t *timer);
+
+/*
+ * preempt_unblock - Let alarms in again from the signal handler
+ *
+ * To be called, with preemption disabled, before switching threads from the
+ * signal handler, which runs with the alarm blocked. An alarm coming in after
+ * that is only recorded as pending until preemption is enabled again.
+ */
+void preempt_unblock(void);
 
 /*
  * preempt_enable - Enable preemption
+ *
+ * Close the critical section of the calling kernel thread. If an alarm came
+ * during it, the deferred preemption happens now.
  */
 void preempt_enable(void);
 
 /*
  * preempt_disable - Disable preemption
+ *
+ * Open a critical section for the calling kernel thread, during which an alarm
+ * only marks a preemption as pending. Does not involve any system call.
+ * Critical sections do not nest: the first preempt_enable() closes it.
  */
 void preempt_disable(void);
 
 
+/**
+ * Private locking API
+ */
+
+/*
+ * uthread_spinlock_t - Lock shared between the workers of the scheduler
+ *
+ * Protects the short critical sections of data that threads running on
+ * different workers can access at the same time. It must only be taken with
+ * preemption disabled, so that its holder cannot be switched out, and never
+ * across a context switch.
+ */
+typedef struct uthread_spinlock {
+	atomic_bool locked;
+} uthread_spinlock_t;
+
+static inline void uthread_spin_init(uthread_spinlock_t *lock)
+{
+	atomic_init(&lock->locked, false);
+}
+
+static inline void uthread_spin_lock(uthread_spinlock_t *lock)
+{
+	int spins = 0;
+
+	while (atomic_exchange_explicit(&lock->locked, true,
+					memory_order_acquire)) {
+		/*
+		 * Spin without writing, and give the processor away if the
+		 * holder's kernel thread seems to have been descheduled
+		 */
+		while (atomic_load_explicit(&lock->locked,
+					    memory_order_relaxed)) {
+			if (++spins == 128) {
+				sched_yield();
+				spins = 0;
+			}
+		}
+	}
+}
+
+static inline void uthread_spin_unlock(uthread_spinlock_t *lock)
+{
+	atomic_store_explicit(&lock->locked, false, memory_order_release);
+}
+
+
 /**
  * Private uthread API
  */
@@ -107,6 +324,23 @@ void preempt_disable(void);
  */
 struct uthread_tcb;
 
+/*
+ * uthread_resume - Finish switching to the current thread
+ *
+ * To be called, with preemption disabled, by a thread that was just switched
+ * to: completes the switch away from the previous thread of the worker, whose
+ * context is only saved by then, and re-enables preemption.
+ */
+void uthread_resume(void);
+
+/*
+ * uthread_preempt - Forcefully yield the current thread
+ *
+ * Called by the preemption timer, outside of any critical section, to put the
+ * current thread back in the ready queue and run the next one.
+ */
+void uthread_preempt(void);
+
 /*
  * uthread_current - Get currently running thread
  *
@@ -114,15 +348,140 @@ struct uthread_tcb;
  */
 struct uthread_tcb *uthread_current(void);
 
+/*
+ * uthread_self - Get currently running thread, with preemption enabled
+ *
+ * Same as uthread_current(), but safe to call outside of a critical section:
+ * the thread is read from the kernel thread in a single access, which stays
+ * right if the caller gets preempted and resumed on another worker around it.
+ *
+ * Return: Pointer to current thread's TCB
+ */
+struct uthread_tcb *uthread_self(void);
+
+/*
+ * uthread_num_workers - Get the number of workers of the scheduler
+ *
+ * Return: Number of kernel threads running the threads of the calling
+ * thread's scheduler
+ */
+int uthread_num_workers(void);
+
+/*
+ * uthread_wait_link - Get the waiting queue link of a thread
+ * @uthread: TCB of thread
+ *
+ * Each thread embeds a link that synchronization primitives can use to queue
+ * the thread while it waits on them, without any allocation.
+ *
+ * Return: Pointer to the waiting queue link of @uthread
+ */
+queue_link_t *uthread_wait_link(struct uthread_tcb *uthread);
+
+/*
+ * uthread_from_wait_link - Get the thread owning a waiting queue link
+ * @link: Link returned by uthread_wait_link()
+ *
+ * Return: TCB of the thread embedding @link
+ */
+struct uthread_tcb *uthread_from_wait_link(queue_link_t *link);
+
+/*
+ * uthread_wait_status - Get the waiting status of a thread
+ * @uthread: TCB of thread
+ *
+ * Each thread embeds a word that synchronization primitives can use to tell a
+ * thread they dequeue from their waiting queue what it was woken up for, e.g.
+ * that it was handed the resource it waits for. It is only accessed under the
+ * lock of the waiting queue, and its meaning is up to the primitive.
+ *
+ * Return: Pointer to the waiting status of @uthread
+ */
+int *uthread_wait_status(struct uthread_tcb *uthread);
+
 /*
  * uthread_block - Block currently running thread
+ *
+ * Preemption is re-enabled on return. Returns right away if the thread was
+ * unblocked since it last blocked, e.g. by a thread on another worker between
+ * enqueueing itself in a waiting queue and calling this.
  */
 void uthread_block(void);
 
 /*
  * uthread_unblock - Unblock thread
  * @uthread: TCB of thread to unblock
+ *
+ * @uthread may be blocked, or still running on another worker on its way to
+ * uthread_block(), in which case that call will not block.
  */
 void uthread_unblock(struct uthread_tcb *uthread);
 
+/*
+ * uthread_now - Get the current time
+ *
+ * Return: Time of the monotonic clock, in nanoseconds
+ */
+int64_t uthread_now(void);
+
+/*
+ * uthread_timeout_start - Unblock the current thread at a given time
+ * @when: Time to unblock the thread at, as returned by uthread_now()
+ *
+ * To be called with preemption disabled. Once @when has come, the current
+ * thread gets unblocked as by uthread_unblock(), unless it called
+ * uthread_timeout_stop() first. The timeout is served by the first worker to
+ * switch threads or be idle after @when. A thread has at most one timeout:
+ * starting another replaces it.
+ */
+void uthread_timeout_start(int64_t when);
+
+/*
+ * uthread_timeout_stop - Cancel the timeout of the current thread
+ *
+ * To be called with preemption disabled. Once it returns, the timeout of the
+ * current thread, if any, can no longer unblock it. If the timeout came while
+ * the thread was running, after something else woke it up, the wake up it left
+ * is taken back, so that the next uthread_block() call does block.
+ */
+void uthread_timeout_stop(void);
+
+/*
+ * uthread_handoff - Unblock thread and switch to it
+ * @uthread: TCB of thread to unblock
+ *
+ * Same as uthread_unblock(), but if @uthread was blocked and may run on the
+ * current worker, the current thread goes back to the ready threads and
+ * switches straight to @uthread, bypassing the scheduling policy. Otherwise,
+ * @uthread is only unblocked. Neither does it switch if the current thread has
+ * a deadline and @uthread has no earlier one.
+ */
+void uthread_handoff(struct uthread_tcb *uthread);
+
+/*
+ * uthread_claim_queue - Take the threads of a waiting queue
+ * @waiting: Queue of waiting queue links (see uthread_wait_link()), left empty
+ * @claimed: Queue receiving the links of the threads that were blocked
+ *
+ * To be called with preemption disabled, under the lock of @waiting, to wake
+ * up all its threads at once. A thread that was blocked is claimed: it stays
+ * out of the ready threads until passed to uthread_wake_queue(), and its link
+ * moves to @claimed. A thread still on its way to uthread_block() only gets a
+ * wake up, as with uthread_unblock(), and its link is left alone.
+ *
+ * Return: Number of threads moved to @claimed
+ */
+int uthread_claim_queue(iqueue_t *waiting, iqueue_t *claimed);
+
+/*
+ * uthread_wake_queue - Make claimed threads ready
+ * @claimed: Queue filled by uthread_claim_queue(), left empty
+ *
+ * To be called with preemption disabled, once the lock of the waiting queue
+ * is released. The threads join the ready threads of the current worker under
+ * a single lock, except those pinned to other workers. None of them runs
+ * before the current thread yields.
+ */
+void uthread_wake_queue(iqueue_t *claimed);
+
 #endif /* _UTHREAD_PRIVATE_H */
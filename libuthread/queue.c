@@ -130,6 +130,114 @@ int queue_dequeue(queue_t queue, void **data) {
     return 0;
 }
 
+/*
+ * queue_enqueue_n - Enqueue several data items
+ * @queue: Queue in which to enqueue items
+ * @data: Array of addresses of data items to enqueue, oldest first
+ * @count: Number of items in @data
+ *
+ * Enqueue the @count addresses of @data in the queue @queue, in order. Either
+ * all items are enqueued or none is.
+ *
+ * Return: -1 if @queue or @data are NULL, if @count is negative or if any item
+ * is NULL, or in case of memory allocation error. 0 if all items were
+ * successfully enqueued in @queue.
+ */
+int queue_enqueue_n(queue_t queue, void **data, int count) {
+    if (queue == NULL || data == NULL || count < 0) {
+        // ERROR: Uninitialized queue / data or bad count
+        return -1;
+    }
+
+    // Build the chain of new nodes aside, so that nothing is enqueued if an
+    // item is invalid or an allocation fails
+    struct queue chain = { 0, NULL, NULL };
+    for (int i = 0; i < count; ++i) {
+        node *new_node = data[i] != NULL ? malloc(sizeof(node)) : NULL;
+        if (new_node == NULL) {
+            // ERROR: NULL item or bad malloc, undo the chain
+            while (chain.head != NULL) {
+                node *next = chain.head->next;
+                free(chain.head);
+                chain.head = next;
+            }
+            return -1;
+        }
+
+        new_node->data = data[i];
+        new_node->next = NULL;
+        new_node->prev = chain.tail;
+        if (chain.tail == NULL) {
+            chain.head = new_node;
+        } else {
+            chain.tail->next = new_node;
+        }
+        chain.tail = new_node;
+        ++(chain.length);
+    }
+
+    return queue_splice(queue, &chain);
+}
+
+/*
+ * queue_dequeue_n - Dequeue several data items
+ * @queue: Queue in which to dequeue items
+ * @data: Array receiving the dequeued items, oldest first
+ * @count: Maximum number of items to dequeue
+ *
+ * Return: -1 if @queue or @data are NULL, or if @count is negative. Number of
+ * items dequeued into @data otherwise, which is less than @count if the queue
+ * did not hold that many items.
+ */
+int queue_dequeue_n(queue_t queue, void **data, int count) {
+    if (queue == NULL || data == NULL || count < 0) {
+        // ERROR: Uninitialized queue / data or bad count
+        return -1;
+    }
+
+    int dequeued = 0;
+    while (dequeued < count && queue_dequeue(queue, &data[dequeued]) == 0) {
+        ++dequeued;
+    }
+    return dequeued;
+}
+
+/*
+ * queue_splice - Move all the items of a queue to the end of another
+ * @dst: Queue receiving the items
+ * @src: Queue whose items are moved, left empty
+ *
+ * The items of @src are appended to @dst in order, in constant time.
+ *
+ * Return: -1 if @dst or @src are NULL or if they are the same queue. 0 if the
+ * items were moved.
+ */
+int queue_splice(queue_t dst, queue_t src) {
+    if (dst == NULL || src == NULL || dst == src) {
+        // ERROR: Uninitialized queues or splicing a queue into itself
+        return -1;
+    }
+
+    if (src->length == 0) {
+        return 0;
+    }
+
+    if (dst->length == 0) {
+        // Destination is empty
+        dst->head = src->head;
+    } else {
+        src->head->prev = dst->tail;
+        dst->tail->next = src->head;
+    }
+    dst->tail = src->tail;
+    dst->length += src->length;
+
+    src->head = NULL;
+    src->tail = NULL;
+    src->length = 0;
+    return 0;
+}
+
 /*
  * queue_delete - Delete data item
  * @queue: Queue in which to delete item
@@ -216,4 +324,171 @@ int queue_length(queue_t queue) {
         return -1;
     }
     return queue->length;
+}
+
+/*
+ * iqueue_unlink - Remove a link known to be in a queue
+ * @queue: Queue holding @link
+ * @link: Link to remove
+ */
+static void iqueue_unlink(iqueue_t *queue, queue_link_t *link) {
+    if (link->prev != NULL) {
+        link->prev->next = link->next;
+    } else {
+        // Link is head
+        queue->head = link->next;
+    }
+
+    if (link->next != NULL) {
+        link->next->prev = link->prev;
+    } else {
+        // Link is tail
+        queue->tail = link->prev;
+    }
+
+    link->prev = NULL;
+    link->next = NULL;
+    --(queue->length);
+}
+
+int iqueue_init(iqueue_t *queue) {
+    if (queue == NULL) {
+        // ERROR: Uninitialized queue
+        return -1;
+    }
+    queue->length = 0;
+    queue->head = NULL;
+    queue->tail = NULL;
+    return 0;
+}
+
+int iqueue_enqueue(iqueue_t *queue, queue_link_t *link) {
+    if (queue == NULL || link == NULL) {
+        // ERROR: Uninitialized queue / link
+        return -1;
+    }
+
+    link->next = NULL;
+    link->prev = queue->tail;
+    if (queue->tail == NULL) {
+        // Queue is empty
+        queue->head = link;
+    } else {
+        queue->tail->next = link;
+    }
+    queue->tail = link;
+
+    ++(queue->length);
+    return 0;
+}
+
+int iqueue_enqueue_head(iqueue_t *queue, queue_link_t *link) {
+    if (queue == NULL || link == NULL) {
+        // ERROR: Uninitialized queue / link
+        return -1;
+    }
+
+    link->prev = NULL;
+    link->next = queue->head;
+    if (queue->head == NULL) {
+        // Queue is empty
+        queue->tail = link;
+    } else {
+        queue->head->prev = link;
+    }
+    queue->head = link;
+
+    ++(queue->length);
+    return 0;
+}
+
+int iqueue_dequeue(iqueue_t *queue, queue_link_t **link) {
+    if (queue == NULL || link == NULL || queue->length == 0) {
+        // ERROR: Uninitialized queue / link or empty queue
+        return -1;
+    }
+
+    *link = queue->head;
+    iqueue_unlink(queue, queue->head);
+    return 0;
+}
+
+int iqueue_splice(iqueue_t *dst, iqueue_t *src) {
+    if (dst == NULL || src == NULL || dst == src) {
+        // ERROR: Uninitialized queues or splicing a queue into itself
+        return -1;
+    }
+
+    if (src->length == 0) {
+        return 0;
+    }
+
+    if (dst->length == 0) {
+        // Destination is empty
+        dst->head = src->head;
+    } else {
+        src->head->prev = dst->tail;
+        dst->tail->next = src->head;
+    }
+    dst->tail = src->tail;
+    dst->length += src->length;
+
+    iqueue_init(src);
+    return 0;
+}
+
+int iqueue_delete(iqueue_t *queue, queue_link_t *link) {
+    if (queue == NULL || link == NULL) {
+        // ERROR: Uninitialized queue / link
+        return -1;
+    }
+
+    // Make sure link belongs to this queue
+    queue_link_t *target = queue->head;
+    while (target != NULL && target != link) {
+        target = target->next;
+    }
+
+    // ERROR: Link not found in queue
+    if (target == NULL) {
+        return -1;
+    }
+
+    iqueue_unlink(queue, target);
+    return 0;
+}
+
+int iqueue_remove(iqueue_t *queue, queue_link_t *link) {
+    if (queue == NULL || link == NULL || queue->length == 0) {
+        // ERROR: Uninitialized queue / link or empty queue
+        return -1;
+    }
+
+    iqueue_unlink(queue, link);
+    return 0;
+}
+
+int iqueue_iterate(iqueue_t *queue, iqueue_func_t func) {
+    if (queue == NULL || func == NULL) {
+        // ERROR: Unintialized queue / func
+        return -1;
+    }
+
+    // Grab next link first in case func deletes the current one
+    queue_link_t *curr_link = queue->head;
+    while (curr_link != NULL) {
+        queue_link_t *next = curr_link->next;
+        func(queue, curr_link);
+        curr_link = next;
+    }
+
+    return 0;
+}
+
+int iqueue_length(iqueue_t *queue) {
+    if (queue == NULL) {
+        // ERROR: Uninitialized queue
+        return -1;
+    }
+    return queue->length;
 }
\ No newline at end of file
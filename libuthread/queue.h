@@ -1,6 +1,8 @@
 #ifndef _QUEUE_H
 #define _QUEUE_H
 
+#include <stddef.h>
+
 /*
  * queue_t - Queue type
  *
@@ -58,6 +60,45 @@ int queue_enqueue(queue_t queue, void *data);
  */
 int queue_dequeue(queue_t queue, void **data);
 
+/*
+ * queue_enqueue_n - Enqueue several data items
+ * @queue: Queue in which to enqueue items
+ * @data: Array of addresses of data items to enqueue, oldest first
+ * @count: Number of items in @data
+ *
+ * Enqueue the @count addresses of @data in the queue @queue, in order. Either
+ * all items are enqueued or none is.
+ *
+ * Return: -1 if @queue or @data are NULL, if @count is negative or if any item
+ * is NULL, or in case of memory allocation error. 0 if all items were
+ * successfully enqueued in @queue.
+ */
+int queue_enqueue_n(queue_t queue, void **data, int count);
+
+/*
+ * queue_dequeue_n - Dequeue several data items
+ * @queue: Queue in which to dequeue items
+ * @data: Array receiving the dequeued items, oldest first
+ * @count: Maximum number of items to dequeue
+ *
+ * Return: -1 if @queue or @data are NULL, or if @count is negative. Number of
+ * items dequeued into @data otherwise, which is less than @count if the queue
+ * did not hold that many items.
+ */
+int queue_dequeue_n(queue_t queue, void **data, int count);
+
+/*
+ * queue_splice - Move all the items of a queue to the end of another
+ * @dst: Queue receiving the items
+ * @src: Queue whose items are moved, left empty
+ *
+ * The items of @src are appended to @dst in order, in constant time.
+ *
+ * Return: -1 if @dst or @src are NULL or if they are the same queue. 0 if the
+ * items were moved.
+ */
+int queue_splice(queue_t dst, queue_t src);
+
 /*
  * queue_delete - Delete data item
  * @queue: Queue in which to delete item
@@ -107,4 +148,144 @@ int queue_iterate(queue_t queue, queue_func_t func);
  */
 int queue_length(queue_t queue);
 
+/*
+ * queue_link_t - Intrusive queue link
+ *
+ * Link fields to embed in a structure so that it can be put in an intrusive
+ * queue (iqueue_t) without any allocation. A link can only be in one intrusive
+ * queue at a time; a structure that needs to be in several queues at once
+ * embeds one link per queue.
+ */
+typedef struct queue_link {
+	struct queue_link *prev;
+	struct queue_link *next;
+} queue_link_t;
+
+/*
+ * iqueue_t - Intrusive queue type
+ *
+ * Same FIFO semantics as queue_t, except that the items are the links embedded
+ * in the caller's structures, so that enqueueing and dequeueing never
+ * allocate. The queue object itself is also meant to be embedded, and must be
+ * initialized with iqueue_init() before use.
+ */
+typedef struct iqueue {
+	int length;
+	queue_link_t *head;
+	queue_link_t *tail;
+} iqueue_t;
+
+/*
+ * iqueue_entry - Get the structure containing a link
+ * @link: Address of the link
+ * @type: Type of the structure the link is embedded in
+ * @member: Name of the link within @type
+ */
+#define iqueue_entry(link, type, member) \
+	((type *)((char *)(link) - offsetof(type, member)))
+
+/*
+ * iqueue_init - Initialize an empty intrusive queue
+ * @queue: Queue to initialize
+ *
+ * Return: -1 if @queue is NULL. 0 otherwise.
+ */
+int iqueue_init(iqueue_t *queue);
+
+/*
+ * iqueue_enqueue - Enqueue link
+ * @queue: Queue in which to enqueue link
+ * @link: Link to enqueue, which must not already be in a queue
+ *
+ * Return: -1 if @queue or @link are NULL. 0 if @link was successfully enqueued
+ * in @queue.
+ */
+int iqueue_enqueue(iqueue_t *queue, queue_link_t *link);
+
+/*
+ * iqueue_enqueue_head - Enqueue link at the head
+ * @queue: Queue in which to enqueue link
+ * @link: Link to enqueue, which must not already be in a queue
+ *
+ * @link becomes the oldest link of @queue, the next one to be dequeued.
+ *
+ * Return: -1 if @queue or @link are NULL. 0 if @link was successfully enqueued
+ * in @queue.
+ */
+int iqueue_enqueue_head(iqueue_t *queue, queue_link_t *link);
+
+/*
+ * iqueue_dequeue - Dequeue link
+ * @queue: Queue in which to dequeue link
+ * @link: Address of link pointer where the oldest link is received
+ *
+ * Return: -1 if @queue or @link are NULL, or if the queue is empty. 0 if @link
+ * was set with the oldest link available in @queue.
+ */
+int iqueue_dequeue(iqueue_t *queue, queue_link_t **link);
+
+/*
+ * iqueue_splice - Move all the links of an intrusive queue to another
+ * @dst: Queue receiving the links
+ * @src: Queue whose links are moved, left empty
+ *
+ * The links of @src are appended to @dst in order, in constant time.
+ *
+ * Return: -1 if @dst or @src are NULL or if they are the same queue. 0 if the
+ * links were moved.
+ */
+int iqueue_splice(iqueue_t *dst, iqueue_t *src);
+
+/*
+ * iqueue_delete - Delete link
+ * @queue: Queue in which to delete link
+ * @link: Link to delete
+ *
+ * Find @link in queue @queue and delete it.
+ *
+ * Return: -1 if @queue or @link are NULL, of if @link was not found in the
+ * queue. 0 if @link was found and deleted from @queue.
+ */
+int iqueue_delete(iqueue_t *queue, queue_link_t *link);
+
+/*
+ * iqueue_remove - Remove link in constant time
+ * @queue: Queue holding @link
+ * @link: Link to remove, which must be in @queue
+ *
+ * Same as iqueue_delete() without searching for @link, for callers that
+ * already know which queue @link is in.
+ *
+ * Return: -1 if @queue or @link are NULL, or if @queue is empty. 0 once @link
+ * was removed from @queue.
+ */
+int iqueue_remove(iqueue_t *queue, queue_link_t *link);
+
+/*
+ * iqueue_func_t - Intrusive queue callback function type
+ * @queue: Queue to which link belongs
+ * @link: Link of the item
+ */
+typedef void (*iqueue_func_t)(iqueue_t *queue, queue_link_t *link);
+
+/*
+ * iqueue_iterate - Iterate through an intrusive queue
+ * @queue: Queue to iterate through
+ * @func: Function to call on each link
+ *
+ * Same as queue_iterate(), including the resistance to the current link being
+ * deleted as part of the iteration.
+ *
+ * Return: -1 if @queue or @func are NULL, 0 otherwise.
+ */
+int iqueue_iterate(iqueue_t *queue, iqueue_func_t func);
+
+/*
+ * iqueue_length - Intrusive queue length
+ * @queue: Queue to get the length of
+ *
+ * Return: -1 if @queue is NULL. Length of @queue otherwise.
+ */
+int iqueue_length(iqueue_t *queue);
+
 #endif /* _QUEUE_H */
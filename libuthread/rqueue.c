@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rqueue.h"
+
+/* Initial number of slots, always a power of two */
+#define RQUEUE_INITIAL_CAPACITY 16
+
+struct rqueue {
+    int length;
+    int capacity;
+    int head;    // Slot of the oldest item
+    int cursor;  // Position of the item being iterated on, -1 if none
+    void **slots;
+};
+
+/* Slot holding the item at position @pos (0 is the oldest) */
+static inline int rqueue_slot(rqueue_t queue, int pos) {
+    return (queue->head + pos) & (queue->capacity - 1);
+}
+
+rqueue_t rqueue_create(void) {
+    rqueue_t new_queue = malloc(sizeof(struct rqueue));
+    if (new_queue == NULL) {
+        // ERROR: Bad malloc
+        return NULL;
+    }
+
+    new_queue->slots = malloc(RQUEUE_INITIAL_CAPACITY * sizeof(void*));
+    if (new_queue->slots == NULL) {
+        // ERROR: Bad malloc
+        free(new_queue);
+        return NULL;
+    }
+
+    new_queue->length = 0;
+    new_queue->capacity = RQUEUE_INITIAL_CAPACITY;
+    new_queue->head = 0;
+    new_queue->cursor = -1;
+    return new_queue;
+}
+
+int rqueue_destroy(rqueue_t queue) {
+    if (queue == NULL || queue->length > 0) {
+        // ERROR: Bad destroy on NULL queue or non-empty queue
+        return -1;
+    }
+
+    free(queue->slots);
+    free(queue);
+    return 0;
+}
+
+/* Double the capacity, unwrapping the items at the start of the new array */
+static int rqueue_grow(rqueue_t queue) {
+    int capacity = 2 * queue->capacity;
+    void **slots = malloc(capacity * sizeof(void*));
+    if (slots == NULL) {
+        // ERROR: Bad malloc
+        return -1;
+    }
+
+    int first = queue->capacity - queue->head;
+    if (first > queue->length) {
+        first = queue->length;
+    }
+    memcpy(slots, queue->slots + queue->head, first * sizeof(void*));
+    memcpy(slots + first, queue->slots, (queue->length - first) * sizeof(void*));
+
+    free(queue->slots);
+    queue->slots = slots;
+    queue->capacity = capacity;
+    queue->head = 0;
+    return 0;
+}
+
+int rqueue_enqueue(rqueue_t queue, void *data) {
+    if (queue == NULL || data == NULL) {
+        // ERROR: Uninitialized queue / data
+        return -1;
+    }
+
+    if (queue->length == queue->capacity && rqueue_grow(queue) < 0) {
+        // ERROR: Failed to grow queue
+        return -1;
+    }
+
+    queue->slots[rqueue_slot(queue, queue->length)] = data;
+    ++(queue->length);
+    return 0;
+}
+
+int rqueue_dequeue(rqueue_t queue, void **data) {
+    if (queue == NULL || data == NULL || queue->length == 0) {
+        // ERROR: Uninitialized queue / data or empty queue
+        return -1;
+    }
+
+    *data = queue->slots[queue->head];
+    queue->head = rqueue_slot(queue, 1);
+    --(queue->length);
+
+    // Keep an ongoing iteration on the same item
+    if (queue->cursor >= 0) {
+        --(queue->cursor);
+    }
+    return 0;
+}
+
+int rqueue_peek(rqueue_t queue, void **data) {
+    if (queue == NULL || data == NULL || queue->length == 0) {
+        // ERROR: Uninitialized queue / data or empty queue
+        return -1;
+    }
+
+    *data = queue->slots[queue->head];
+    return 0;
+}
+
+int rqueue_delete(rqueue_t queue, void *data) {
+    if (queue == NULL || data == NULL) {
+        // ERROR: queue / data is empty
+        return -1;
+    }
+
+    // Find position of target data
+    int pos = 0;
+    while (pos < queue->length
+            && queue->slots[rqueue_slot(queue, pos)] != data) {
+        ++pos;
+    }
+
+    // ERROR: Data not found in queue
+    if (pos == queue->length) {
+        return -1;
+    }
+
+    // Close the gap from the shorter side
+    if (pos < queue->length / 2) {
+        for (int i = pos; i > 0; --i) {
+            queue->slots[rqueue_slot(queue, i)] =
+                queue->slots[rqueue_slot(queue, i - 1)];
+        }
+        queue->head = rqueue_slot(queue, 1);
+    } else {
+        for (int i = pos; i < queue->length - 1; ++i) {
+            queue->slots[rqueue_slot(queue, i)] =
+                queue->slots[rqueue_slot(queue, i + 1)];
+        }
+    }
+    --(queue->length);
+
+    // Items after the deleted one moved down a position
+    if (queue->cursor >= pos) {
+        --(queue->cursor);
+    }
+    return 0;
+}
+
+int rqueue_iterate(rqueue_t queue, rqueue_func_t func) {
+    if (queue == NULL || func == NULL) {
+        // ERROR: Unintialized queue / func
+        return -1;
+    }
+
+    // The cursor is adjusted by deletions, so that it always designates the
+    // last visited item. An enclosing iteration resumes at its own position,
+    // not adjusted for deletions done during this one.
+    int outer_cursor = queue->cursor;
+    for (queue->cursor = 0; queue->cursor < queue->length; ++(queue->cursor)) {
+        func(queue, queue->slots[rqueue_slot(queue, queue->cursor)]);
+    }
+    queue->cursor = outer_cursor;
+
+    return 0;
+}
+
+int rqueue_length(rqueue_t queue) {
+    if (queue == NULL) {
+        // ERROR: Uninitialized queue
+        return -1;
+    }
+    return queue->length;
+}
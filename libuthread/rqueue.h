@@ -0,0 +1,105 @@
+#ifndef _RQUEUE_H
+#define _RQUEUE_H
+
+/*
+ * rqueue_t - Ring-buffer queue type
+ *
+ * Same FIFO queue as queue_t, but items are stored in a growable circular array
+ * instead of a linked list of nodes. Enqueueing does not allocate, except when
+ * the array needs to grow (its capacity doubles), and consecutive items are
+ * contiguous in memory.
+ *
+ * Enqueue, dequeue and length operations are O(1) (amortized for enqueue).
+ * Delete is O(n) and shifts the items on the shorter side of the deleted one.
+ */
+typedef struct rqueue* rqueue_t;
+
+/*
+ * rqueue_create - Allocate an empty ring-buffer queue
+ *
+ * Return: Pointer to new empty queue. NULL in case of failure when allocating
+ * the new queue.
+ */
+rqueue_t rqueue_create(void);
+
+/*
+ * rqueue_destroy - Deallocate a ring-buffer queue
+ * @queue: Queue to deallocate
+ *
+ * Return: -1 if @queue is NULL or if @queue is not empty. 0 if @queue was
+ * successfully destroyed.
+ */
+int rqueue_destroy(rqueue_t queue);
+
+/*
+ * rqueue_enqueue - Enqueue data item
+ * @queue: Queue in which to enqueue item
+ * @data: Address of data item to enqueue
+ *
+ * Return: -1 if @queue or @data are NULL, or in case of memory allocation error
+ * when growing the queue. 0 if @data was successfully enqueued in @queue.
+ */
+int rqueue_enqueue(rqueue_t queue, void *data);
+
+/*
+ * rqueue_dequeue - Dequeue data item
+ * @queue: Queue in which to dequeue item
+ * @data: Address of data pointer where item is received
+ *
+ * Return: -1 if @queue or @data are NULL, or if the queue is empty. 0 if @data
+ * was set with the oldest item available in @queue.
+ */
+int rqueue_dequeue(rqueue_t queue, void **data);
+
+/*
+ * rqueue_peek - Get the oldest data item without dequeuing it
+ * @queue: Queue to look into
+ * @data: Address of data pointer where item is received
+ *
+ * Return: -1 if @queue or @data are NULL, or if the queue is empty. 0 if @data
+ * was set with the oldest item available in @queue.
+ */
+int rqueue_peek(rqueue_t queue, void **data);
+
+/*
+ * rqueue_delete - Delete data item
+ * @queue: Queue in which to delete item
+ * @data: Data to delete
+ *
+ * Find in queue @queue, the first (ie oldest) item equal to @data and delete
+ * this item.
+ *
+ * Return: -1 if @queue or @data are NULL, of if @data was not found in the
+ * queue. 0 if @data was found and deleted from @queue.
+ */
+int rqueue_delete(rqueue_t queue, void *data);
+
+/*
+ * rqueue_func_t - Ring-buffer queue callback function type
+ * @queue: Queue to which item belongs
+ * @data: Data item
+ */
+typedef void (*rqueue_func_t)(rqueue_t queue, void *data);
+
+/*
+ * rqueue_iterate - Iterate through a ring-buffer queue
+ * @queue: Queue to iterate through
+ * @func: Function to call on each queue item
+ *
+ * Calls @func on every item, from the oldest to the newest. @func may delete or
+ * dequeue any item of @queue, including the current one: the iteration then
+ * continues with the item that followed the current one.
+ *
+ * Return: -1 if @queue or @func are NULL, 0 otherwise.
+ */
+int rqueue_iterate(rqueue_t queue, rqueue_func_t func);
+
+/*
+ * rqueue_length - Ring-buffer queue length
+ * @queue: Queue to get the length of
+ *
+ * Return: -1 if @queue is NULL. Length of @queue otherwise.
+ */
+int rqueue_length(rqueue_t queue);
+
+#endif /* _RQUEUE_H */
@@ -0,0 +1,353 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "queue.h"
+#include "rwlock.h"
+#include "private.h"
+
+// State of a reader-writer lock: a writer holds it
+#define RWLOCK_WRITER  1UL
+// State of a reader-writer lock: threads are in its waiting queues
+#define RWLOCK_WAITERS 2UL
+// State of a reader-writer lock: one more reader holds it
+#define RWLOCK_READER  4UL
+
+/*
+ * uthread_rwlock_t - Reader-writer lock type
+ *
+ * The state word holds the number of readers, in units of RWLOCK_READER, along
+ * with RWLOCK_WRITER and RWLOCK_WAITERS. The uncontended paths only ever go
+ * through the state, with a single compare and swap. Once the waiters bit is
+ * set, new readers and writers take the spinlock to get in line, and the
+ * holders take it to wake the waiters up when they release the lock: the state
+ * then only changes under the spinlock.
+ *
+ * The waiters bit is only set or cleared under the spinlock, and is set
+ * whenever one of the waiting queues is not empty or a writer was woken up.
+ * Readers only ever wait while a writer holds the lock or waits for it.
+ *
+ * Woken up threads do not own the lock, but take it once they run, as threads
+ * owning the lock while still waiting to run would keep the others out. A
+ * writer woken up holds off new readers until then. The readers woken up
+ * together are not touched one by one: each wake up of the readers increments
+ * the read epoch, and a reader woken up in a later epoch than the one it
+ * started waiting in may take the lock past the waiting writers.
+ */
+struct uthread_rwlock {
+    _Atomic unsigned long state; // Readers, RWLOCK_WRITER and RWLOCK_WAITERS
+    uthread_spinlock_t lock; // Waiting queues, across workers
+    unsigned long read_epoch; // Wake ups of the waiting readers so far
+    size_t woken_writers; // Writers woken up that did not run yet
+    size_t waiters; // Threads blocked on the lock, woken or not
+    iqueue_t readers_queue;
+    iqueue_t writers_queue;
+};
+
+/*
+ * uthread_rwlock_create - Create reader-writer lock
+ *
+ * Allocate and initialize an unlocked reader-writer lock.
+ *
+ * Return: Pointer to initialized lock. NULL in case of failure when allocating
+ * the new lock.
+ */
+uthread_rwlock_t uthread_rwlock_create(void) {
+    // Allocate atomically, the allocator is not safe against preemption
+    preempt_disable();
+    uthread_rwlock_t new_rwlock = malloc(sizeof(struct uthread_rwlock));
+    preempt_enable();
+    if (new_rwlock == NULL) {
+        // ERROR: Bad malloc
+        return NULL;
+    }
+
+    atomic_init(&(new_rwlock->state), 0);
+    uthread_spin_init(&(new_rwlock->lock));
+    new_rwlock->read_epoch = 0;
+    new_rwlock->woken_writers = 0;
+    new_rwlock->waiters = 0;
+    iqueue_init(&(new_rwlock->readers_queue));
+    iqueue_init(&(new_rwlock->writers_queue));
+    return new_rwlock;
+}
+
+/*
+ * uthread_rwlock_destroy - Deallocate a reader-writer lock
+ * @rwlock: Lock to deallocate
+ *
+ * Deallocate reader-writer lock @rwlock.
+ *
+ * Return: -1 if @rwlock is NULL, locked, or if threads are still being blocked
+ * on @rwlock. 0 if @rwlock was successfully destroyed.
+ */
+int uthread_rwlock_destroy(uthread_rwlock_t rwlock) {
+    if (rwlock == NULL) {
+        // ERROR: Bad rwlock destroy
+        return -1;
+    }
+
+    // Threads woken up still have to run, possibly on another worker
+    preempt_disable();
+    uthread_spin_lock(&(rwlock->lock));
+    bool busy = atomic_load(&(rwlock->state)) != 0 || rwlock->waiters > 0;
+    uthread_spin_unlock(&(rwlock->lock));
+    preempt_enable();
+    if (busy) {
+        // ERROR: Bad rwlock destroy, lock held or threads still blocked on it
+        return -1;
+    }
+
+    preempt_disable();
+    free(rwlock);
+    preempt_enable();
+    return 0;
+}
+
+// Contended path of uthread_rwlock_rdlock()
+void uthread_rwlock_rdlock_slow(uthread_rwlock_t rwlock) {
+    preempt_disable();
+    uthread_spin_lock(&(rwlock->lock));
+    ++(rwlock->waiters);
+    bool woken = false;
+    while (1) {
+        // Join the readers, unless a writer holds the lock, or waits for it
+        // and the thread was not woken up along with the other readers
+        unsigned long state = atomic_load_explicit(&(rwlock->state),
+            memory_order_relaxed);
+        if (!(state & RWLOCK_WRITER) && (woken
+                || (rwlock->writers_queue.head == NULL
+                    && rwlock->woken_writers == 0))) {
+            if (atomic_compare_exchange_weak_explicit(&(rwlock->state),
+                    &state, state + RWLOCK_READER,
+                    memory_order_acquire, memory_order_relaxed)) {
+                break;
+            }
+            continue;
+        }
+
+        // Make the holders take the slow path to unlock it, then wait for the
+        // next wake up of the readers
+        if (!(state & RWLOCK_WAITERS) && !atomic_compare_exchange_weak_explicit(
+                &(rwlock->state), &state, state | RWLOCK_WAITERS,
+                memory_order_relaxed, memory_order_relaxed)) {
+            continue;
+        }
+        struct uthread_tcb *current_thread = uthread_current();
+        unsigned long epoch = rwlock->read_epoch;
+        iqueue_enqueue(&(rwlock->readers_queue),
+            uthread_wait_link(current_thread));
+        while (rwlock->read_epoch == epoch) {
+            uthread_spin_unlock(&(rwlock->lock));
+            uthread_block();
+            preempt_disable();
+            uthread_spin_lock(&(rwlock->lock));
+        }
+        woken = true;
+    }
+    --(rwlock->waiters);
+    uthread_spin_unlock(&(rwlock->lock));
+    preempt_enable();
+}
+
+/*
+ * uthread_rwlock_rdlock - Lock a reader-writer lock for reading
+ * @rwlock: Lock to take
+ *
+ * Take @rwlock along with the other readers. The caller thread is blocked
+ * while a writer holds or waits for @rwlock.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully locked.
+ */
+int uthread_rwlock_rdlock(uthread_rwlock_t rwlock) {
+    if (rwlock == NULL) {
+        // ERROR: Uninitialized rwlock
+        return -1;
+    }
+
+    unsigned long state = atomic_load_explicit(&(rwlock->state),
+        memory_order_relaxed);
+    while (!(state & (RWLOCK_WRITER | RWLOCK_WAITERS))) {
+        if (atomic_compare_exchange_weak_explicit(&(rwlock->state), &state,
+                state + RWLOCK_READER,
+                memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    uthread_rwlock_rdlock_slow(rwlock);
+    return 0;
+}
+
+// Contended path of uthread_rwlock_wrlock()
+void uthread_rwlock_wrlock_slow(uthread_rwlock_t rwlock) {
+    preempt_disable();
+    uthread_spin_lock(&(rwlock->lock));
+    ++(rwlock->waiters);
+    bool woken = false;
+    while (1) {
+        // Take the lock if nobody holds it, even if others wait for it
+        unsigned long state = atomic_load_explicit(&(rwlock->state),
+            memory_order_relaxed);
+        if (!(state & ~RWLOCK_WAITERS)) {
+            bool waiters = rwlock->readers_queue.head != NULL
+                || rwlock->writers_queue.head != NULL
+                || rwlock->woken_writers > (woken ? 1 : 0);
+            if (atomic_compare_exchange_weak_explicit(&(rwlock->state),
+                    &state, RWLOCK_WRITER | (waiters ? RWLOCK_WAITERS : 0),
+                    memory_order_acquire, memory_order_relaxed)) {
+                break;
+            }
+            continue;
+        }
+
+        // Make the holders take the slow path to unlock it, then wait in line
+        // until woken up, back at the head of the line if another thread took
+        // the lock first
+        if (!(state & RWLOCK_WAITERS) && !atomic_compare_exchange_weak_explicit(
+                &(rwlock->state), &state, state | RWLOCK_WAITERS,
+                memory_order_relaxed, memory_order_relaxed)) {
+            continue;
+        }
+        struct uthread_tcb *current_thread = uthread_current();
+        int *dequeued = uthread_wait_status(current_thread);
+        *dequeued = 0;
+        if (woken) {
+            --(rwlock->woken_writers);
+            iqueue_enqueue_head(&(rwlock->writers_queue),
+                uthread_wait_link(current_thread));
+        } else {
+            iqueue_enqueue(&(rwlock->writers_queue),
+                uthread_wait_link(current_thread));
+        }
+        while (!*dequeued) {
+            uthread_spin_unlock(&(rwlock->lock));
+            uthread_block();
+            preempt_disable();
+            uthread_spin_lock(&(rwlock->lock));
+        }
+        woken = true;
+    }
+    if (woken) {
+        --(rwlock->woken_writers);
+    }
+    --(rwlock->waiters);
+    uthread_spin_unlock(&(rwlock->lock));
+    preempt_enable();
+}
+
+/*
+ * uthread_rwlock_wrlock - Lock a reader-writer lock for writing
+ * @rwlock: Lock to take
+ *
+ * Take @rwlock alone. The caller thread is blocked while other threads hold
+ * @rwlock, and behind the writers already waiting for it.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully locked.
+ */
+int uthread_rwlock_wrlock(uthread_rwlock_t rwlock) {
+    if (rwlock == NULL) {
+        // ERROR: Uninitialized rwlock
+        return -1;
+    }
+
+    unsigned long unlocked = 0;
+    if (atomic_compare_exchange_strong_explicit(&(rwlock->state), &unlocked,
+            RWLOCK_WRITER, memory_order_acquire, memory_order_relaxed)) {
+        return 0;
+    }
+    uthread_rwlock_wrlock_slow(rwlock);
+    return 0;
+}
+
+// Contended path of uthread_rwlock_unlock(), for a writer or the last reader
+void uthread_rwlock_unlock_slow(uthread_rwlock_t rwlock, bool writer) {
+    preempt_disable();
+    uthread_spin_lock(&(rwlock->lock));
+    if (!writer && (atomic_load_explicit(&(rwlock->state),
+            memory_order_relaxed) & ~RWLOCK_WAITERS) != RWLOCK_READER) {
+        // Other readers are still in
+        atomic_fetch_sub_explicit(&(rwlock->state), RWLOCK_READER,
+            memory_order_release);
+        uthread_spin_unlock(&(rwlock->lock));
+        preempt_enable();
+        return;
+    }
+
+    // Wake up the next threads in line: after a writer, all the waiting
+    // readers at once, and after the last reader, the first waiting writer
+    bool readers = rwlock->readers_queue.head != NULL;
+    bool writers = rwlock->writers_queue.head != NULL;
+    iqueue_t claimed;
+    iqueue_init(&claimed);
+    queue_link_t *link = NULL;
+    if (readers && (writer || !writers)) {
+        ++(rwlock->read_epoch);
+        uthread_claim_queue(&(rwlock->readers_queue), &claimed);
+    } else if (writers) {
+        iqueue_dequeue(&(rwlock->writers_queue), &link);
+        *uthread_wait_status(uthread_from_wait_link(link)) = 1;
+        ++(rwlock->woken_writers);
+    }
+    bool waiters = rwlock->readers_queue.head != NULL
+        || rwlock->writers_queue.head != NULL || rwlock->woken_writers > 0;
+    atomic_store_explicit(&(rwlock->state), waiters ? RWLOCK_WAITERS : 0,
+        memory_order_release);
+    uthread_spin_unlock(&(rwlock->lock));
+
+    // Wake them up, to take the lock once they run
+    uthread_wake_queue(&claimed);
+    if (link != NULL) {
+        uthread_unblock(uthread_from_wait_link(link));
+    }
+    preempt_enable();
+}
+
+/*
+ * uthread_rwlock_unlock - Unlock a reader-writer lock
+ * @rwlock: Lock to release
+ *
+ * Release @rwlock, held by the caller for reading or writing. The last reader
+ * out wakes up the first waiting writer. A writer wakes up all the waiting
+ * readers if any, in a single batch, or else the next writer.
+ *
+ * Return: -1 if @rwlock is NULL or not locked. 0 if @rwlock was successfully
+ * unlocked.
+ */
+int uthread_rwlock_unlock(uthread_rwlock_t rwlock) {
+    if (rwlock == NULL) {
+        // ERROR: Uninitialized rwlock
+        return -1;
+    }
+
+    unsigned long state = atomic_load_explicit(&(rwlock->state),
+        memory_order_relaxed);
+    while (1) {
+        if (state & RWLOCK_WRITER) {
+            if (state & RWLOCK_WAITERS) {
+                uthread_rwlock_unlock_slow(rwlock, true);
+                return 0;
+            }
+            if (atomic_compare_exchange_weak_explicit(&(rwlock->state),
+                    &state, 0, memory_order_release, memory_order_relaxed)) {
+                return 0;
+            }
+            continue;
+        }
+
+        if (state < RWLOCK_READER) {
+            // ERROR: Rwlock not locked
+            return -1;
+        }
+        if ((state & RWLOCK_WAITERS)
+                && (state & ~RWLOCK_WAITERS) == RWLOCK_READER) {
+            uthread_rwlock_unlock_slow(rwlock, false);
+            return 0;
+        }
+        if (atomic_compare_exchange_weak_explicit(&(rwlock->state), &state,
+                state - RWLOCK_READER,
+                memory_order_release, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef _RWLOCK_H
+#define _RWLOCK_H
+
+/*
+ * uthread_rwlock_t - Reader-writer lock type
+ *
+ * A reader-writer lock lets any number of readers, or a single writer, into a
+ * critical section. Readers never block each other: a reader only waits for a
+ * writer holding the lock or waiting for it.
+ *
+ * Writers come first: once a writer waits, new readers wait behind it rather
+ * than keep it out. Readers are batched in return: a writer unlocking the lock
+ * wakes up all the readers waiting at that time at once, which then take it
+ * past the waiting writers, and the last of them wakes up the next writer.
+ * A thread woken up takes the lock once it runs, unless a writer took it
+ * first, in which case it waits again.
+ *
+ * Taking or releasing the lock while nobody waits is a single atomic
+ * operation, without disabling preemption nor any system call.
+ */
+typedef struct uthread_rwlock *uthread_rwlock_t;
+
+/*
+ * uthread_rwlock_create - Create reader-writer lock
+ *
+ * Allocate and initialize an unlocked reader-writer lock.
+ *
+ * Return: Pointer to initialized lock. NULL in case of failure when allocating
+ * the new lock.
+ */
+uthread_rwlock_t uthread_rwlock_create(void);
+
+/*
+ * uthread_rwlock_destroy - Deallocate a reader-writer lock
+ * @rwlock: Lock to deallocate
+ *
+ * Deallocate reader-writer lock @rwlock. A thread woken up counts as blocked
+ * on @rwlock until it has returned from uthread_rwlock_rdlock() or
+ * uthread_rwlock_wrlock().
+ *
+ * Return: -1 if @rwlock is NULL, locked, or if threads are still being blocked
+ * on @rwlock. 0 if @rwlock was successfully destroyed.
+ */
+int uthread_rwlock_destroy(uthread_rwlock_t rwlock);
+
+/*
+ * uthread_rwlock_rdlock - Lock a reader-writer lock for reading
+ * @rwlock: Lock to take
+ *
+ * Take @rwlock along with the other readers. The caller thread is blocked
+ * while a writer holds or waits for @rwlock.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully locked.
+ */
+int uthread_rwlock_rdlock(uthread_rwlock_t rwlock);
+
+/*
+ * uthread_rwlock_wrlock - Lock a reader-writer lock for writing
+ * @rwlock: Lock to take
+ *
+ * Take @rwlock alone. The caller thread is blocked while other threads hold
+ * @rwlock, and behind the writers already waiting for it.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully locked.
+ */
+int uthread_rwlock_wrlock(uthread_rwlock_t rwlock);
+
+/*
+ * uthread_rwlock_unlock - Unlock a reader-writer lock
+ * @rwlock: Lock to release
+ *
+ * Release @rwlock, held by the caller for reading or writing. The last reader
+ * out wakes up the first waiting writer. A writer wakes up all the waiting
+ * readers if any, in a single batch, or else the next writer.
+ *
+ * Return: -1 if @rwlock is NULL or not locked. 0 if @rwlock was successfully
+ * unlocked.
+ */
+int uthread_rwlock_unlock(uthread_rwlock_t rwlock);
+
+#endif /* _RWLOCK_H */
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 
@@ -16,8 +17,12 @@
  * following threads are blocked until the resource becomes available again.
  */
 struct semaphore {
+    uthread_spinlock_t lock; // Count and waiting queue, across workers
+    int    flags; // Creation flags
     size_t count;
-    queue_t waiting_queue;
+    size_t waiters; // Threads in sem_down() waiting for count, woken or not
+    size_t woken; // Woken up waiters yet to take count, in barging mode
+    iqueue_t waiting_queue;
 };
 
 /*
@@ -30,14 +35,42 @@ struct semaphore {
  * allocating the new semaphore.
  */
 sem_t sem_create(size_t count) {
+    return sem_create_ex(count, 0);
+}
+
+/*
+ * sem_create_ex - Create semaphore with flags
+ * @count: Semaphore count
+ * @flags: Bitwise or of semaphore creation flags, or 0
+ *
+ * Same as sem_create(), but the semaphore behaves according to @flags.
+ *
+ * Return: Pointer to initialized semaphore. NULL in case of failure when
+ * allocating the new semaphore, or if @flags has unknown bits set or combines
+ * SEM_BARGE with another mode.
+ */
+sem_t sem_create_ex(size_t count, int flags) {
+    if ((flags & ~(SEM_HANDOFF | SEM_DIRECT | SEM_BARGE))
+            || ((flags & SEM_BARGE) && (flags & ~SEM_BARGE))) {
+        // ERROR: Unknown or conflicting flags
+        return NULL;
+    }
+
+    // Allocate atomically, the allocator is not safe against preemption
+    preempt_disable();
     sem_t new_sem = malloc(sizeof(struct semaphore));
+    preempt_enable();
     if (new_sem == NULL) {
         // ERROR: Bad malloc 
         return NULL;
     }
 
-    new_sem->waiting_queue = queue_create();
+    uthread_spin_init(&(new_sem->lock));
+    iqueue_init(&(new_sem->waiting_queue));
+    new_sem->flags = flags & SEM_DIRECT ? flags | SEM_HANDOFF : flags;
     new_sem->count = count;
+    new_sem->waiters = 0;
+    new_sem->woken = 0;
     return new_sem;
 }
 
@@ -51,14 +84,26 @@ sem_t sem_create(size_t count) {
  * @sem. 0 is @sem was successfully destroyed.
  */
 int sem_destroy(sem_t sem) {
-    if (sem == NULL || queue_length(sem->waiting_queue) > 0) {
+    if (sem == NULL) {
         // ERROR: Bad sem destroy
         return -1;
     }
 
-    // Free waiting queue
-    queue_destroy(sem->waiting_queue);
+    // A thread woken up by sem_up() still has to take the count, possibly on
+    // another worker
+    preempt_disable();
+    uthread_spin_lock(&(sem->lock));
+    size_t waiters = sem->waiters;
+    uthread_spin_unlock(&(sem->lock));
+    preempt_enable();
+    if (waiters > 0) {
+        // ERROR: Bad sem destroy, threads still blocked on it
+        return -1;
+    }
+
+    preempt_disable();
     free(sem);
+    preempt_enable();
     return 0;
 }
 
@@ -81,20 +126,87 @@ int sem_down(sem_t sem) {
 
     // Atomically check sem->count
     preempt_disable();
+    uthread_spin_lock(&(sem->lock));
+    if (sem->count == 0 && (sem->flags & SEM_HANDOFF)) {
+        // Wait in line until sem_up() dequeues this thread and hands it a
+        // unit. Until then, any wake up is spurious: keep waiting in place.
+        struct uthread_tcb *current_thread = uthread_current();
+        int *handed = uthread_wait_status(current_thread);
+        *handed = 0;
+        ++(sem->waiters);
+        iqueue_enqueue(&(sem->waiting_queue),
+            uthread_wait_link(current_thread));
+        while (!*handed) {
+            uthread_spin_unlock(&(sem->lock));
+            uthread_block();
+            preempt_disable();
+            uthread_spin_lock(&(sem->lock));
+        }
+        --(sem->waiters);
+        uthread_spin_unlock(&(sem->lock));
+        preempt_enable();
+        return 0;
+    }
+    if (sem->count == 0 && (sem->flags & SEM_BARGE)) {
+        // Wait until sem_up() dequeues this thread, then take count unless a
+        // thread barged in first, in which case wait again, first in line
+        struct uthread_tcb *current_thread = uthread_current();
+        int *dequeued = uthread_wait_status(current_thread);
+        ++(sem->waiters);
+        iqueue_enqueue(&(sem->waiting_queue),
+            uthread_wait_link(current_thread));
+        while (1) {
+            *dequeued = 0;
+            while (!*dequeued) {
+                uthread_spin_unlock(&(sem->lock));
+                uthread_block();
+                preempt_disable();
+                uthread_spin_lock(&(sem->lock));
+            }
+            --(sem->woken);
+            if (sem->count > 0) {
+                break;
+            }
+            iqueue_enqueue_head(&(sem->waiting_queue),
+                uthread_wait_link(current_thread));
+        }
+        --(sem->count);
+        --(sem->waiters);
+        uthread_spin_unlock(&(sem->lock));
+        preempt_enable();
+        return 0;
+    }
+
+    bool waited = sem->count == 0;
+    if (waited) {
+        ++(sem->waiters);
+    }
     while (sem->count == 0) {
         // Atomically enqueue current thread to sem's waiting queue
         struct uthread_tcb *current_thread = uthread_current();
-        queue_enqueue(sem->waiting_queue, current_thread);
-
-        // Block current thread (uthread_block will re-enable preemption)
-        uthread_block();
+        int *dequeued = uthread_wait_status(current_thread);
+        *dequeued = 0;
+        iqueue_enqueue(&(sem->waiting_queue),
+            uthread_wait_link(current_thread));
 
-        // Atomically check sem->count
-        preempt_disable();
+        // Block current thread until sem_up() dequeues it (uthread_block will
+        // re-enable preemption). A sem_up() on another worker may already have
+        // unblocked it, in which case this returns right away, and any other
+        // wake up is spurious: the thread is still in line.
+        while (!*dequeued) {
+            uthread_spin_unlock(&(sem->lock));
+            uthread_block();
+            preempt_disable();
+            uthread_spin_lock(&(sem->lock));
+        }
     }
 
     // Perform sem decrement
     --(sem->count);
+    if (waited) {
+        --(sem->waiters);
+    }
+    uthread_spin_unlock(&(sem->lock));
 
     // Re-enable preemption
     preempt_enable();
@@ -110,7 +222,7 @@ int sem_down(sem_t sem) {
  *
  * If the waiting list associated to @sem is not empty, releasing a resource
  * also causes the first thread (i.e. the oldest) in the waiting list to be
- * unblocked.
+ * unblocked, and handed the resource with SEM_HANDOFF or SEM_DIRECT.
  *
  * Return: -1 if @sem is NULL. 0 if semaphore was successfully released.
  */
@@ -122,19 +234,45 @@ int sem_up(sem_t sem) {
 
     // Atomically increment sem and dequeue from waiting queue
     preempt_disable();
+    uthread_spin_lock(&(sem->lock));
 
-    // Perform sem increment
-    ++(sem->count);
-
-    // Wake up first in line if any
-    int num_threads = queue_length(sem->waiting_queue);
-    if (num_threads > 0) {
-        struct uthread_tcb *unblocked_thread;
-        queue_dequeue(sem->waiting_queue, (void**)&unblocked_thread);
+    // Wake up first in line if any, handing it the unit in handoff mode, or
+    // else perform sem increment. The semaphore may be destroyed as soon as
+    // it is unlocked.
+    int flags = sem->flags;
+    queue_link_t *link;
+    int waiting;
+    if (flags & SEM_BARGE) {
+        // Waiters already woken up are enough to take the units, if any
+        ++(sem->count);
+        waiting = sem->count > sem->woken ? iqueue_dequeue(
+            &(sem->waiting_queue), &link) : -1;
+        if (waiting == 0) {
+            *uthread_wait_status(uthread_from_wait_link(link)) = 1;
+            ++(sem->woken);
+        }
+    } else {
+        waiting = iqueue_dequeue(&(sem->waiting_queue), &link);
+        if (waiting == 0) {
+            *uthread_wait_status(uthread_from_wait_link(link)) = 1;
+        }
+        if (waiting != 0 || !(flags & SEM_HANDOFF)) {
+            ++(sem->count);
+        }
+    }
+    uthread_spin_unlock(&(sem->lock));
+    if (waiting == 0) {
+        struct uthread_tcb *unblocked_thread = uthread_from_wait_link(link);
 
-        // Unblock awakend thread (uthread_unblock will re-enable preemption)
-        uthread_unblock(unblocked_thread);
+        // Unblock awakend thread, running it right away in direct mode
+        if (flags & SEM_DIRECT) {
+            uthread_handoff(unblocked_thread);
+        } else {
+            uthread_unblock(unblocked_thread);
+        }
     }
 
+    // Re-enable preemption (also when nobody was waiting)
+    preempt_enable();
     return 0;
 }
@@ -15,6 +15,35 @@
  */
 typedef struct semaphore *sem_t;
 
+/*
+ * Semaphore creation flags
+ *
+ * Without flags, sem_up() wakes up the oldest waiter, which takes a unit once
+ * it runs, unless another thread took it first. It then waits again at the
+ * back of the line.
+ *
+ * SEM_HANDOFF: A unit released by sem_up() while threads are waiting goes
+ *	straight to the oldest of them, instead of to the count. The woken up
+ *	thread returns from sem_down() without checking the count again, and no
+ *	other thread can take the unit in the meantime.
+ * SEM_DIRECT: Same as SEM_HANDOFF, and sem_up() also switches to the woken up
+ *	thread right away when it can run on the same worker, instead of leaving
+ *	it behind the other ready threads. The releasing thread goes back to the
+ *	ready threads.
+ * SEM_FIFO: Strict FIFO fairness, same as SEM_HANDOFF. Threads get units in
+ *	the order they asked for them, and a waiter only waits for the threads
+ *	ahead of it in line.
+ * SEM_BARGE: Throughput mode. sem_down() takes any available unit, even while
+ *	others wait, and sem_up() only wakes up a waiter if there are more units
+ *	than waiters already woken up and on their way to take one. A woken up
+ *	waiter that finds the units taken waits again at the head of the line.
+ *	Cannot be combined with SEM_HANDOFF or SEM_DIRECT.
+ */
+#define SEM_HANDOFF	0x1
+#define SEM_DIRECT	0x2
+#define SEM_FIFO	SEM_HANDOFF
+#define SEM_BARGE	0x4
+
 /*
  * sem_create - Create semaphore
  * @count: Semaphore count
@@ -26,11 +55,25 @@ typedef struct semaphore *sem_t;
  */
 sem_t sem_create(size_t count);
 
+/*
+ * sem_create_ex - Create semaphore with flags
+ * @count: Semaphore count
+ * @flags: Bitwise or of semaphore creation flags, or 0
+ *
+ * Same as sem_create(), but the semaphore behaves according to @flags.
+ *
+ * Return: Pointer to initialized semaphore. NULL in case of failure when
+ * allocating the new semaphore, or if @flags has unknown bits set or combines
+ * SEM_BARGE with another mode.
+ */
+sem_t sem_create_ex(size_t count, int flags);
+
 /*
  * sem_destroy - Deallocate a semaphore
  * @sem: Semaphore to deallocate
  *
- * Deallocate semaphore @sem.
+ * Deallocate semaphore @sem. A thread woken up by sem_up() counts as blocked
+ * on @sem until it has returned from sem_down().
  *
  * Return: -1 if @sem is NULL or if other threads are still being blocked on
  * @sem. 0 is @sem was successfully destroyed.
@@ -58,7 +101,7 @@ int sem_down(sem_t sem);
  *
  * If the waiting list associated to @sem is not empty, releasing a resource
  * also causes the first thread (i.e. the oldest) in the waiting list to be
- * unblocked.
+ * unblocked, and handed the resource with SEM_HANDOFF or SEM_DIRECT.
  *
  * Return: -1 if @sem is NULL. 0 if semaphore was successfully released.
  */
@@ -1,188 +1,1653 @@
 #include <assert.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 #include "private.h"
 #include "uthread.h"
+#include "heap.h"
+#include "policy.h"
 #include "queue.h"
 
 // Thread struct
 // =============================================================================
+// Where a thread currently is, which tells the scheduler queue it is linked in
+typedef enum uthread_state {
+    UTHREAD_RUNNING, // Current thread of a worker, in no queue
+    UTHREAD_READY,   // In the ready queue of a worker
+    UTHREAD_BLOCKED, // Switched out by uthread_block(), in no queue
+    UTHREAD_WAKEUP,  // Unblocked while still running, will not block
+    UTHREAD_ZOMBIE,  // Exited, in the pool or freed
+} uthread_state_t;
+
+struct uthread_worker;
+
 typedef struct uthread_tcb {
     uthread_ctx_t ctx; // Thread context
+    _Atomic uthread_state_t state; // Scheduling state
+    struct uthread_worker *home; // Worker the thread is pinned to, if any
     void  *stack_head; // Stack
+    size_t stack_size; // Size of the stack
+    size_t stack_painted; // Bytes of the stack painted for measurement
+    uthread_func_t func; // Entry function
+    void  *arg; // Argument of the entry function
+    struct uthread_sched sched; // Scheduling data, the links of which hold
+                                // the thread in the ready threads of a worker
+    queue_link_t wait_link; // Link in a synchronization waiting queue
+    int    wait_status; // Why the thread was dequeued from a waiting queue
+    struct uthread_tcb *pool_next; // Next free thread while in the pool
+    int64_t deadline; // Monotonic time (ns) to be done by, 0 if none
+    heap_link_t timeout_link; // Link in the timeouts of the scheduler
+    int64_t timeout; // Monotonic time (ns) to be unblocked at, 0 if none, -1
+                     // if it came while the thread was running
+
+    // Shared stack mode (stack_head is NULL, pinned to the worker owning the
+    // shared stack)
+    bool   shared; // Runs on the shared stack
+    bool   fresh; // Not started yet, context still to be initialized
+    void   *save_buf; // Live part of the stack while off the shared stack
+    size_t save_size; // Bytes saved in save_buf
+    size_t save_capacity; // Size of save_buf
 } uthread_tcb;
 
+// Shared stack of a worker
+// Threads created in shared stack mode all run on one large stack. The stack
+// holds the live frames of its owner, which are only copied out to the owner's
+// save buffer when another shared stack thread needs to run, and copied back
+// when the owner is resumed.
+struct uthread_shared_stack {
+    void          *stack; // Shared stack segment
+    uthread_tcb   *owner; // Thread whose frames are on the shared stack
+    uthread_ctx_t copier_ctx; // Context copying frames in and out
+    void          *copier_stack; // Stack of the copier context
+    uthread_tcb   *copy_next; // Thread the copier hands the stack to
+};
+
+// Bounded free-list of exited threads, kept with their stacks so that
+// uthread_create() does not have to go through the allocator again
+struct uthread_pool {
+    uthread_spinlock_t lock;
+    uthread_tcb *head;
+    size_t      capacity;
+    struct uthread_pool_stats stats;
+};
+
 // Scheduler
 // =============================================================================
-queue_t     ready_queue;
-queue_t     blocked_queue;
-queue_t     zombie_queue;
-uthread_tcb *current_thread = NULL;
+// Each call to uthread_run() runs its own scheduler instance, independent from
+// the ones other kernel threads may be running at the same time. The instance
+// lives in the thread-local storage of the kernel thread calling uthread_run(),
+// and its workers all point to it.
+//
+// Each worker is a kernel thread running user threads from its own ready
+// threads, in the order of the scheduling policy, and stealing ready threads
+// of the other workers when it has none. When there is nothing to run at all,
+// it waits in its idle loop, on its kernel thread's own stack.
+struct uthread_scheduler;
 
-struct uthread_tcb *uthread_current(void) {
-    return current_thread;
+typedef struct uthread_worker {
+    int                id;
+    struct uthread_scheduler *scheduler;
+    pthread_t          pthread;
+    uthread_spinlock_t lock; // Protects the ready threads
+    iheap_t            deadline_heap; // Ready deadline threads by deadline
+    void               *policy_data; // Other ready threads, kept by the policy
+    int64_t            switch_time; // Time of the last switch, when the policy
+                                    // accounts for run times
+    atomic_int         ready_length; // Readable without the lock
+    preempt_timer_t    timer; // Preemption timer of the kernel thread
+    bool               tick_switch; // Switching on a tick, at a slice boundary
+    uthread_tcb        *current_thread; // Running thread
+    uthread_tcb        idle_thread; // Context of the idle loop
+    uthread_tcb        *prev_thread; // Thread switched away from
+    uthread_state_t    prev_state; // What to make of it once switched out
+    struct uthread_shared_stack shared_stack;
+} uthread_worker_t;
+
+#define UTHREAD_POOL_DEFAULT_CAPACITY 64
+
+typedef struct uthread_scheduler {
+    uthread_worker_t *workers;
+    int              num_workers;
+    atomic_long      runnable; // Threads that are running or ready
+    atomic_int       sleepers; // Idle workers waiting for ready threads
+    bool             preempt; // Preemptive scheduling
+    const uthread_policy_t *policy; // Order of the ready threads
+    clockid_t        clock; // Clock measuring the time slices
+    pthread_mutex_t  idle_lock;
+    pthread_cond_t   idle_cond;
+    struct uthread_pool thread_pool;
+    uthread_spinlock_t deadline_lock; // Protects the deadline stats
+    struct uthread_deadline_stats deadline_stats;
+    uthread_spinlock_t timeout_lock; // Protects the timeouts
+    iheap_t          timeout_heap; // Threads to unblock, by time
+    _Atomic int64_t  next_timeout; // Earliest timeout, INT64_MAX if none
+} uthread_scheduler_t;
+
+// Scheduler instance of the kernel thread, used when it calls uthread_run()
+__thread uthread_scheduler_t local_scheduler = {
+    .idle_lock = PTHREAD_MUTEX_INITIALIZER,
+    .idle_cond = PTHREAD_COND_INITIALIZER,
+    .thread_pool = { .capacity = UTHREAD_POOL_DEFAULT_CAPACITY },
+};
+
+// Worker that the kernel thread runs, NULL outside of uthread_run()
+__thread uthread_worker_t *this_worker;
+
+// Worker running the calling kernel thread
+// Not inlined: a thread can be resumed on another worker, so the address of
+// this_worker must not be kept across a context switch
+__attribute__((noinline)) uthread_worker_t *uthread_worker(void) {
+    return this_worker;
+}
+
+// Running thread of the kernel thread, mirroring current_thread of its worker
+// Read in a single access, so that it is right even if the reader gets
+// preempted and resumed on another worker right before
+__thread uthread_tcb *this_thread;
+
+// Thread running the caller, readable with preemption enabled
+__attribute__((noinline)) struct uthread_tcb *uthread_self(void) {
+    return this_thread;
+}
+
+// Scheduler instance of the calling thread: the one running it, or the one
+// the kernel thread would run
+uthread_scheduler_t *uthread_scheduler(void) {
+    uthread_worker_t *worker = uthread_worker();
+    return worker != NULL ? worker->scheduler : &local_scheduler;
+}
+
+int uthread_num_workers(void) {
+    return uthread_scheduler()->num_workers;
+}
+
+// Order threads by deadline
+int uthread_deadline_cmp(const heap_link_t *a, const heap_link_t *b) {
+    int64_t deadline_a = iheap_entry(a, uthread_tcb, sched.heap_link)->deadline;
+    int64_t deadline_b = iheap_entry(b, uthread_tcb, sched.heap_link)->deadline;
+    return (deadline_a > deadline_b) - (deadline_a < deadline_b);
+}
+
+// Ready threads
+// Ready threads with a deadline are kept in a heap by deadline, and run before
+// any other. The others are kept by the scheduling policy (see policy.h), in
+// the data it has for each worker.
+int uthread_ready_init(uthread_worker_t *worker,
+        const uthread_policy_t *policy) {
+    uthread_spin_init(&(worker->lock));
+    atomic_init(&(worker->ready_length), 0);
+    iheap_init(&(worker->deadline_heap), uthread_deadline_cmp);
+    worker->policy_data = calloc(1, policy->worker_size);
+    if (worker->policy_data == NULL) {
+        // ERROR: Bad malloc
+        return -1;
+    }
+    if (policy->init != NULL && policy->init(worker->policy_data) < 0) {
+        // ERROR: Failed to init the policy
+        free(worker->policy_data);
+        worker->policy_data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void uthread_ready_destroy(uthread_worker_t *worker,
+        const uthread_policy_t *policy) {
+    if (policy->destroy != NULL) {
+        policy->destroy(worker->policy_data);
+    }
+    free(worker->policy_data);
+    worker->policy_data = NULL;
+}
+
+// Take the next thread to run out of a worker's ready threads: the one with
+// the earliest deadline, or else the one the policy picks. NULL if there is
+// none, none that should run instead of @current when given, or none that may
+// go to another worker when stealing (lock held)
+uthread_tcb *uthread_ready_next(uthread_worker_t *worker,
+        uthread_tcb *current, bool steal) {
+    uthread_tcb *thread = NULL;
+    heap_link_t *link;
+    if (iheap_peek(&(worker->deadline_heap), &link) == 0) {
+        thread = iheap_entry(link, uthread_tcb, sched.heap_link);
+        if ((current != NULL && current->deadline != 0
+                && thread->deadline >= current->deadline)
+                || (steal && thread->sched.pinned)) {
+            return NULL;
+        }
+        iheap_pop(&(worker->deadline_heap), &link);
+    } else if (current == NULL || current->deadline == 0) {
+        // Only threads with an earlier deadline run before a deadline thread
+        struct uthread_sched *sched = worker->scheduler->policy->pick_next(
+            worker->policy_data, current != NULL ? &(current->sched) : NULL,
+            steal);
+        if (sched != NULL) {
+            thread = iqueue_entry(sched, uthread_tcb, sched);
+        }
+    }
+
+    if (thread != NULL) {
+        atomic_fetch_sub(&(worker->ready_length), 1);
+    }
+    return thread;
+}
+
+// Current time of the monotonic clock, in nanoseconds
+int64_t uthread_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Add the time the current thread of a worker ran since the last switch to the
+// run time its policy has yet to account for (preemption disabled)
+void uthread_account(uthread_worker_t *worker) {
+    int64_t now = uthread_now();
+    uthread_tcb *current_thread = worker->current_thread;
+    if (current_thread != &(worker->idle_thread)) {
+        current_thread->sched.runtime += now - worker->switch_time;
+    }
+    worker->switch_time = now;
+}
+
+// Tell the policy of a worker that its running thread blocked
+void uthread_policy_block(uthread_worker_t *worker, uthread_tcb *thread) {
+    const uthread_policy_t *policy = worker->scheduler->policy;
+    if (policy->on_block != NULL) {
+        policy->on_block(worker->policy_data, &(thread->sched));
+    }
+}
+
+// Tell the policy of a worker that a thread is about to join its ready
+// threads, and whether it should run before @current when given
+bool uthread_policy_wake(uthread_worker_t *worker, uthread_tcb *thread,
+        uthread_tcb *current) {
+    const uthread_policy_t *policy = worker->scheduler->policy;
+    return policy->on_wake != NULL && policy->on_wake(worker->policy_data,
+        &(thread->sched), current != NULL ? &(current->sched) : NULL);
+}
+
+// Wake up the idle workers after making threads ready
+void uthread_idle_kick(uthread_scheduler_t *scheduler) {
+    if (atomic_load(&(scheduler->sleepers)) > 0) {
+        pthread_mutex_lock(&(scheduler->idle_lock));
+        pthread_cond_broadcast(&(scheduler->idle_cond));
+        pthread_mutex_unlock(&(scheduler->idle_lock));
+    }
+}
+
+// Preemption ticks
+// A worker of a preemptive scheduler only needs the timer while it has threads
+// waiting in its ready queue. It asks for ticks when it gets one, and stops
+// needing them when it has nothing else to run than its current thread.
+
+// Get ticks for a worker whose ready queue is not empty (preemption disabled)
+void uthread_tick_start(uthread_worker_t *worker) {
+    if (worker->scheduler->preempt) {
+        preempt_tick_get(&(worker->timer));
+    }
 }
 
-// Swap threads from current thread to new thread
-void uthread_swap_threads(void) {
-    if (queue_length(ready_queue) == 0) {
+// Stop the ticks of a worker whose ready queue is empty (preemption disabled)
+void uthread_tick_stop(uthread_worker_t *worker) {
+    if (!worker->scheduler->preempt) {
         return;
     }
+    preempt_tick_put(&(worker->timer));
+
+    // A thread made ready meanwhile may not have seen the ticks stop
+    if (atomic_load(&(worker->ready_length)) > 0) {
+        preempt_tick_get(&(worker->timer));
+    }
+}
+
+// Insert a thread into the ready threads of a worker, by its deadline if it has
+// one, or else as the policy orders it (worker lock held)
+void uthread_ready_insert(uthread_worker_t *worker, uthread_tcb *thread) {
+    atomic_store_explicit(&(thread->state), UTHREAD_READY,
+        memory_order_relaxed);
+    if (thread->deadline != 0) {
+        iheap_insert(&(worker->deadline_heap), &(thread->sched.heap_link));
+    } else {
+        worker->scheduler->policy->enqueue(worker->policy_data,
+            &(thread->sched));
+    }
+}
+
+// Make a thread ready on a worker (preemption disabled)
+void uthread_ready_enqueue(uthread_worker_t *worker, uthread_tcb *thread) {
+    uthread_spin_lock(&(worker->lock));
+    uthread_ready_insert(worker, thread);
+    atomic_fetch_add(&(worker->ready_length), 1);
+    uthread_spin_unlock(&(worker->lock));
+
+    uthread_tick_start(worker);
+    uthread_idle_kick(worker->scheduler);
+}
 
-    // Retrieve next ready thread (atomic)
+// Dequeue the next thread to run on a worker, if there is one that should run
+// instead of @current when given (preemption disabled)
+uthread_tcb *uthread_ready_dequeue(uthread_worker_t *worker,
+        uthread_tcb *current) {
+    if (atomic_load_explicit(&(worker->ready_length),
+            memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    uthread_spin_lock(&(worker->lock));
+    uthread_tcb *thread = uthread_ready_next(worker, current, false);
+    uthread_spin_unlock(&(worker->lock));
+    return thread;
+}
+
+// Take a ready thread of another worker, if there is one that should run
+// instead of @current when given and that may leave its worker (preemption
+// disabled)
+uthread_tcb *uthread_ready_steal(uthread_worker_t *thief,
+        uthread_tcb *current) {
+    uthread_scheduler_t *scheduler = thief->scheduler;
+    for (int i = 1; i < scheduler->num_workers; i++) {
+        uthread_worker_t *victim =
+            &(scheduler->workers[(thief->id + i) % scheduler->num_workers]);
+        if (atomic_load_explicit(&(victim->ready_length),
+                memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        uthread_spin_lock(&(victim->lock));
+        uthread_tcb *thread = uthread_ready_next(victim, current, true);
+        uthread_spin_unlock(&(victim->lock));
+
+        if (thread != NULL) {
+            uthread_policy_wake(thief, thread, NULL);
+            return thread;
+        }
+    }
+    return NULL;
+}
+
+// Number of ready threads over all workers
+int uthread_ready_total(uthread_scheduler_t *scheduler) {
+    int total = 0;
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        total += atomic_load(&(scheduler->workers[i].ready_length));
+    }
+    return total;
+}
+
+// Make a thread that was neither running nor ready runnable, on its home
+// worker or on the calling one (preemption disabled)
+// Returns whether it went to the calling worker and should run before the
+// current thread, which should then yield to it: it has an earlier deadline,
+// or else the policy says so
+bool uthread_wake(uthread_tcb *thread) {
+    uthread_worker_t *worker = uthread_worker();
+    uthread_worker_t *target = thread->home != NULL ? thread->home : worker;
+    atomic_fetch_add(&(worker->scheduler->runnable), 1);
+
+    uthread_tcb *current = NULL;
+    if (target == worker && worker->current_thread != &(worker->idle_thread)) {
+        current = worker->current_thread;
+        if (worker->scheduler->policy->account) {
+            uthread_account(worker);
+        }
+    }
+    bool preempts = uthread_policy_wake(target, thread, current);
+    uthread_ready_enqueue(target, thread);
+
+    if (current == NULL) {
+        return false;
+    }
+    if (thread->deadline != 0 || current->deadline != 0) {
+        return thread->deadline != 0 && (current->deadline == 0
+            || thread->deadline < current->deadline);
+    }
+    return preempts;
+}
+
+// Account for a thread that stopped being runnable, letting the idle workers
+// return once the last one is gone
+void uthread_runnable_dec(uthread_scheduler_t *scheduler) {
+    if (atomic_fetch_sub(&(scheduler->runnable), 1) == 1) {
+        pthread_mutex_lock(&(scheduler->idle_lock));
+        pthread_cond_broadcast(&(scheduler->idle_cond));
+        pthread_mutex_unlock(&(scheduler->idle_lock));
+    }
+}
+
+// Thread pool
+// =============================================================================
+// Each scheduler instance has its own pool (see struct uthread_pool), which
+// its workers share
+
+// Free a thread and its stack for good
+void uthread_destroy(uthread_tcb *thread) {
+    if (thread->stack_head != NULL) {
+        uthread_ctx_destroy_stack(thread->stack_head, thread->stack_size);
+    }
+    free(thread->save_buf);
+    free(thread);
+}
+
+// Take a cached thread whose stack has @stack_size bytes (0 for shared stack
+// threads) from the pool, NULL if there is none (preemption disabled)
+uthread_tcb *uthread_pool_get(struct uthread_pool *thread_pool,
+        size_t stack_size) {
+    uthread_spin_lock(&(thread_pool->lock));
+    uthread_tcb **link = &(thread_pool->head);
+    while (*link != NULL && (*link)->stack_size != stack_size) {
+        link = &((*link)->pool_next);
+    }
+
+    uthread_tcb *thread = *link;
+    if (thread == NULL) {
+        ++(thread_pool->stats.misses);
+    } else {
+        *link = thread->pool_next;
+        --(thread_pool->stats.cached);
+        ++(thread_pool->stats.hits);
+    }
+    uthread_spin_unlock(&(thread_pool->lock));
+    return thread;
+}
+
+// Push an exited thread into the pool if there is room, or free it otherwise
+// (preemption disabled)
+void uthread_pool_put(struct uthread_pool *thread_pool, uthread_tcb *thread) {
+    uthread_spin_lock(&(thread_pool->lock));
+    bool cached = thread_pool->stats.cached < thread_pool->capacity;
+    if (cached) {
+        thread->pool_next = thread_pool->head;
+        thread_pool->head = thread;
+        ++(thread_pool->stats.cached);
+        ++(thread_pool->stats.recycled);
+    } else {
+        ++(thread_pool->stats.released);
+    }
+    uthread_spin_unlock(&(thread_pool->lock));
+
+    if (!cached) {
+        uthread_destroy(thread);
+    }
+}
+
+// Free cached threads until the pool holds at most @capacity of them
+void uthread_pool_trim(struct uthread_pool *thread_pool, size_t capacity) {
     preempt_disable();
-    uthread_tcb *prev_thread = current_thread;
-    queue_dequeue(ready_queue, (void**)&current_thread);
+    uthread_spin_lock(&(thread_pool->lock));
+    uthread_tcb *trimmed = NULL;
+    while (thread_pool->stats.cached > capacity) {
+        uthread_tcb *thread = thread_pool->head;
+        thread_pool->head = thread->pool_next;
+        --(thread_pool->stats.cached);
+        thread->pool_next = trimmed;
+        trimmed = thread;
+    }
+    uthread_spin_unlock(&(thread_pool->lock));
     preempt_enable();
 
-    // Switch context
-    uthread_ctx_switch(&(prev_thread->ctx), &(current_thread->ctx));
+    while (trimmed != NULL) {
+        uthread_tcb *thread = trimmed;
+        trimmed = thread->pool_next;
+        uthread_destroy(thread);
+    }
 }
 
-void uthread_yield(void) {
-    // Enqueue current thread into ready queue (atomic)
+void uthread_pool_set_capacity(size_t capacity) {
+    struct uthread_pool *thread_pool = &(uthread_scheduler()->thread_pool);
+    thread_pool->capacity = capacity;
+    uthread_pool_trim(thread_pool, capacity);
+}
+
+void uthread_pool_get_stats(struct uthread_pool_stats *stats) {
+    struct uthread_pool *thread_pool = &(uthread_scheduler()->thread_pool);
+    if (stats != NULL) {
+        preempt_disable();
+        uthread_spin_lock(&(thread_pool->lock));
+        *stats = thread_pool->stats;
+        uthread_spin_unlock(&(thread_pool->lock));
+        preempt_enable();
+    }
+}
+
+// Stack usage
+// =============================================================================
+// Per entry function stack usage, collected at thread exit when enabled. Kept
+// for the whole process rather than per scheduler instance, as it is meant to
+// be read once the schedulers are done.
+struct uthread_stack_stats {
+    uthread_spinlock_t lock;
+    bool   enabled;
+    int    length;
+    int    capacity;
+    struct uthread_stack_usage *usage;
+} stack_stats;
+
+void uthread_stack_measure(bool enable) {
     preempt_disable();
-    queue_enqueue(ready_queue, current_thread);
+    uthread_spin_lock(&(stack_stats.lock));
+    if (enable) {
+        stack_stats.length = 0;
+    }
+    stack_stats.enabled = enable;
+    uthread_spin_unlock(&(stack_stats.lock));
     preempt_enable();
+}
+
+// Find or add the usage entry of @func (lock held)
+struct uthread_stack_usage *uthread_stack_usage_of(uthread_func_t func) {
+    for (int i = 0; i < stack_stats.length; i++) {
+        if (stack_stats.usage[i].func == func) {
+            return &(stack_stats.usage[i]);
+        }
+    }
+
+    if (stack_stats.length == stack_stats.capacity) {
+        int capacity = stack_stats.capacity ? 2 * stack_stats.capacity : 8;
+        void *usage = realloc(stack_stats.usage,
+            capacity * sizeof(struct uthread_stack_usage));
+        if (usage == NULL) {
+            // ERROR: Bad malloc, drop this measurement
+            return NULL;
+        }
+        stack_stats.usage = usage;
+        stack_stats.capacity = capacity;
+    }
+
+    struct uthread_stack_usage *entry = &(stack_stats.usage[stack_stats.length++]);
+    *entry = (struct uthread_stack_usage){ .func = func };
+    return entry;
+}
+
+// Record the peak stack depth of an exiting thread (preemption disabled)
+// The thread is still running on its stack, but at exit it is shallower than
+// any depth it previously reached
+void uthread_stack_record(uthread_tcb *thread) {
+    if (thread->stack_painted == 0 || thread->func == NULL) {
+        return;
+    }
+
+    size_t depth = uthread_ctx_stack_depth(thread->stack_head,
+        thread->stack_size);
+
+    // Next reuse of this stack only needs to repaint what was used, plus what
+    // the rest of the exit path is about to use
+    thread->stack_painted = depth + 2048;
+
+    uthread_spin_lock(&(stack_stats.lock));
+    struct uthread_stack_usage *entry = uthread_stack_usage_of(thread->func);
+    if (entry != NULL) {
+        int bucket = 0;
+        while (bucket < UTHREAD_STACK_HIST_BUCKETS - 1
+                && depth > ((size_t)1024 << bucket)) {
+            ++bucket;
+        }
+
+        ++(entry->threads);
+        ++(entry->histogram[bucket]);
+        entry->total_depth += depth;
+        if (depth > entry->max_depth) {
+            entry->max_depth = depth;
+        }
+    }
+    uthread_spin_unlock(&(stack_stats.lock));
+}
+
+int uthread_stack_get_usage(struct uthread_stack_usage *usage, int count) {
+    preempt_disable();
+    uthread_spin_lock(&(stack_stats.lock));
+    int length = stack_stats.length;
+    for (int i = 0; usage != NULL && i < count && i < length; i++) {
+        usage[i] = stack_stats.usage[i];
+    }
+    uthread_spin_unlock(&(stack_stats.lock));
+    preempt_enable();
+    return length;
+}
+
+void uthread_stack_dump_usage(FILE *stream) {
+    fprintf(stream, "%-18s %8s %10s %10s %10s  %s\n", "func", "threads",
+        "avg", "max", "suggested", "histogram (KiB:threads)");
+
+    preempt_disable();
+    uthread_spin_lock(&(stack_stats.lock));
+    for (int i = 0; i < stack_stats.length; i++) {
+        struct uthread_stack_usage *entry = &(stack_stats.usage[i]);
+
+        // Leave a margin of 1 KiB for signal frames, then round to pages
+        size_t suggested = uthread_ctx_stack_size(entry->max_depth + 1024);
+
+        fprintf(stream, "%-18p %8zu %10zu %10zu %10zu ",
+            (void*)entry->func, entry->threads,
+            entry->total_depth / entry->threads, entry->max_depth, suggested);
+        for (int bucket = 0; bucket < UTHREAD_STACK_HIST_BUCKETS; bucket++) {
+            if (entry->histogram[bucket] > 0) {
+                fprintf(stream, " %s%zu:%zu",
+                    bucket == UTHREAD_STACK_HIST_BUCKETS - 1 ? ">" : "<=",
+                    (size_t)1 << (bucket == UTHREAD_STACK_HIST_BUCKETS - 1
+                        ? bucket - 1 : bucket),
+                    entry->histogram[bucket]);
+            }
+        }
+        fprintf(stream, "\n");
+    }
+    uthread_spin_unlock(&(stack_stats.lock));
+    preempt_enable();
+}
+
+// Shared stack
+// =============================================================================
+// Each worker has its own shared stack, used by the shared stack threads
+// pinned to it (see struct uthread_shared_stack)
+
+// Make @next the owner of the shared stack (preemption disabled)
+// Must not run on the shared stack, as the frames of @next are copied over it
+void uthread_shared_handoff(struct uthread_shared_stack *shared_stack,
+        uthread_tcb *next) {
+    char *top = (char*)shared_stack->stack + UTHREAD_SHARED_STACK_SIZE;
+    uthread_tcb *owner = shared_stack->owner;
+
+    // Save the live part of the previous owner's stack, everything if the
+    // context backend cannot tell where it ends
+    if (owner != NULL) {
+        char *sp = uthread_ctx_stack_pointer(&(owner->ctx));
+        if (sp == NULL) {
+            sp = shared_stack->stack;
+        }
+
+        // Right-size the buffer, growing it or shrinking it if far too big
+        size_t size = top - sp;
+        if (size > owner->save_capacity || size < owner->save_capacity / 4) {
+            void *buf = realloc(owner->save_buf, size);
+            if (buf == NULL) {
+                // ERROR: Bad malloc, the owner's frames would be lost
+                perror("realloc");
+                exit(1);
+            }
+            owner->save_buf = buf;
+            owner->save_capacity = size;
+        }
+        memcpy(owner->save_buf, sp, size);
+        owner->save_size = size;
+    }
+
+    // Set up the frames of the next owner
+    if (next->fresh) {
+        uthread_ctx_init(&(next->ctx), shared_stack->stack,
+            UTHREAD_SHARED_STACK_SIZE, next->func, next->arg);
+        next->fresh = false;
+    } else {
+        memcpy(top - next->save_size, next->save_buf, next->save_size);
+    }
+    shared_stack->owner = next;
+}
+
+// Copier context body, entered with preemption disabled when a thread running
+// on the shared stack switches to another shared stack thread
+void uthread_shared_copier(void *arg) {
+    struct uthread_shared_stack *shared_stack = arg;
+
+    while (1) {
+        uthread_shared_handoff(shared_stack, shared_stack->copy_next);
+        uthread_ctx_switch(&(shared_stack->copier_ctx),
+            &(shared_stack->copy_next->ctx));
+    }
+}
+
+// Allocate the shared stack and the copier context (preemption disabled)
+int uthread_shared_init(struct uthread_shared_stack *shared_stack) {
+    if (shared_stack->stack != NULL) {
+        return 0;
+    }
+
+    size_t copier_size = uthread_ctx_stack_size(0);
+    shared_stack->stack = uthread_ctx_alloc_stack(UTHREAD_SHARED_STACK_SIZE);
+    shared_stack->copier_stack = uthread_ctx_alloc_stack(copier_size);
+    if (shared_stack->stack == NULL || shared_stack->copier_stack == NULL
+            || uthread_ctx_init_raw(&(shared_stack->copier_ctx),
+                shared_stack->copier_stack, copier_size,
+                uthread_shared_copier, shared_stack) < 0) {
+        // ERROR: Failed to alloc stacks
+        if (shared_stack->stack != NULL) {
+            uthread_ctx_destroy_stack(shared_stack->stack,
+                UTHREAD_SHARED_STACK_SIZE);
+        }
+        if (shared_stack->copier_stack != NULL) {
+            uthread_ctx_destroy_stack(shared_stack->copier_stack,
+                copier_size);
+        }
+        shared_stack->stack = NULL;
+        shared_stack->copier_stack = NULL;
+        return -1;
+    }
+
+    shared_stack->owner = NULL;
+    return 0;
+}
+
+// Release the shared stack once no thread uses it anymore
+void uthread_shared_destroy(struct uthread_shared_stack *shared_stack) {
+    if (shared_stack->stack == NULL) {
+        return;
+    }
+
+    uthread_ctx_destroy_stack(shared_stack->stack, UTHREAD_SHARED_STACK_SIZE);
+    uthread_ctx_destroy_stack(shared_stack->copier_stack,
+        uthread_ctx_stack_size(0));
+    shared_stack->stack = NULL;
+    shared_stack->copier_stack = NULL;
+    shared_stack->owner = NULL;
+}
+
+// Deadlines
+// =============================================================================
+// A thread with a deadline runs before the threads without one, and before the
+// ones with a later deadline. Deadlines are counted as met or missed once the
+// thread is done with them, by replacing or clearing them or by exiting.
+
+// Count the deadline of a thread that is done with it (preemption disabled)
+void uthread_deadline_end(uthread_scheduler_t *scheduler,
+        uthread_tcb *thread) {
+    if (thread->deadline == 0) {
+        return;
+    }
+
+    int64_t lateness = uthread_now() - thread->deadline;
+    thread->deadline = 0;
+
+    uthread_spin_lock(&(scheduler->deadline_lock));
+    struct uthread_deadline_stats *stats = &(scheduler->deadline_stats);
+    if (lateness > 0) {
+        ++(stats->missed);
+        if (lateness > stats->max_lateness) {
+            stats->max_lateness = lateness;
+        }
+    } else {
+        ++(stats->met);
+    }
+    uthread_spin_unlock(&(scheduler->deadline_lock));
+}
+
+int uthread_set_deadline(long deadline) {
+    if (deadline < 0) {
+        // ERROR: Invalid deadline
+        return -1;
+    }
+
+    preempt_disable();
+    uthread_worker_t *worker = uthread_worker();
+    uthread_tcb *current_thread = worker->current_thread;
+    uthread_deadline_end(worker->scheduler, current_thread);
+    if (deadline > 0) {
+        current_thread->deadline = uthread_now() + deadline * 1000;
+    }
+
+    // Make way for the ready threads that are now due first
+    uthread_spin_lock(&(worker->lock));
+    heap_link_t *link;
+    bool yield = iheap_peek(&(worker->deadline_heap), &link) == 0
+        && (current_thread->deadline == 0 || current_thread->deadline
+            > iheap_entry(link, uthread_tcb, sched.heap_link)->deadline);
+    uthread_spin_unlock(&(worker->lock));
+    preempt_enable();
+    if (yield) {
+        uthread_yield();
+    }
+    return 0;
+}
+
+void uthread_deadline_get_stats(struct uthread_deadline_stats *stats) {
+    uthread_scheduler_t *scheduler = uthread_scheduler();
+    if (stats != NULL) {
+        preempt_disable();
+        uthread_spin_lock(&(scheduler->deadline_lock));
+        *stats = scheduler->deadline_stats;
+        uthread_spin_unlock(&(scheduler->deadline_lock));
+        preempt_enable();
+    }
+}
+
+// Timeouts
+// =============================================================================
+// A thread waiting with a timeout is kept in a heap of the scheduler by the
+// time to unblock it at. Any worker unblocks the threads whose time has come
+// when it switches threads or is idle, and idle workers sleep no longer than
+// until the earliest timeout. A thread running alone on its worker is not
+// interrupted to serve timeouts.
+
+bool uthread_claim(uthread_tcb *uthread);
+
+// Order threads by timeout
+int uthread_timeout_cmp(const heap_link_t *a, const heap_link_t *b) {
+    int64_t timeout_a = iheap_entry(a, uthread_tcb, timeout_link)->timeout;
+    int64_t timeout_b = iheap_entry(b, uthread_tcb, timeout_link)->timeout;
+    return (timeout_a > timeout_b) - (timeout_a < timeout_b);
+}
+
+// Publish the earliest timeout of a scheduler (timeout lock held)
+void uthread_timeout_update(uthread_scheduler_t *scheduler) {
+    heap_link_t *link;
+    int64_t next = INT64_MAX;
+    if (iheap_peek(&(scheduler->timeout_heap), &link) == 0) {
+        next = iheap_entry(link, uthread_tcb, timeout_link)->timeout;
+    }
+    atomic_store_explicit(&(scheduler->next_timeout), next,
+        memory_order_relaxed);
+}
+
+// Whether threads of a scheduler wait with a timeout
+bool uthread_timeout_pending(uthread_scheduler_t *scheduler) {
+    return atomic_load_explicit(&(scheduler->next_timeout),
+        memory_order_relaxed) != INT64_MAX;
+}
+
+void uthread_timeout_start(int64_t when) {
+    uthread_worker_t *worker = uthread_worker();
+    uthread_scheduler_t *scheduler = worker->scheduler;
+    uthread_tcb *current_thread = worker->current_thread;
+    uthread_spin_lock(&(scheduler->timeout_lock));
+    if (current_thread->timeout > 0) {
+        iheap_remove(&(scheduler->timeout_heap),
+            &(current_thread->timeout_link));
+    }
+    current_thread->timeout = when > 0 ? when : 1;
+    iheap_insert(&(scheduler->timeout_heap), &(current_thread->timeout_link));
+    uthread_timeout_update(scheduler);
+    uthread_spin_unlock(&(scheduler->timeout_lock));
+    // Idle workers sleeping for good have to sleep until the timeout instead
+    uthread_idle_kick(scheduler);
+}
+
+void uthread_timeout_stop(void) {
+    uthread_worker_t *worker = uthread_worker();
+    uthread_scheduler_t *scheduler = worker->scheduler;
+    uthread_tcb *current_thread = worker->current_thread;
+    uthread_spin_lock(&(scheduler->timeout_lock));
+    if (current_thread->timeout > 0) {
+        iheap_remove(&(scheduler->timeout_heap),
+            &(current_thread->timeout_link));
+        uthread_timeout_update(scheduler);
+    } else if (current_thread->timeout < 0) {
+        // The timeout came once the thread was woken up otherwise, and left
+        // it a wake up its next uthread_block() would take for its own: take
+        // it back
+        uthread_state_t wakeup = UTHREAD_WAKEUP;
+        atomic_compare_exchange_strong(&(current_thread->state), &wakeup,
+            UTHREAD_RUNNING);
+    }
+    current_thread->timeout = 0;
+    uthread_spin_unlock(&(scheduler->timeout_lock));
+}
+
+// Unblock the threads whose timeout has come (preemption disabled)
+// A thread is claimed under the timeout lock, so that it gets no wake up once
+// it has stopped its timeout. One still running is only left a wake up, which
+// uthread_timeout_stop() takes back.
+void uthread_timeout_expire(uthread_worker_t *worker) {
+    uthread_scheduler_t *scheduler = worker->scheduler;
+    if (!uthread_timeout_pending(scheduler)) {
+        return;
+    }
+
+    int64_t now = uthread_now();
+    while (atomic_load_explicit(&(scheduler->next_timeout),
+            memory_order_relaxed) <= now) {
+        uthread_spin_lock(&(scheduler->timeout_lock));
+        heap_link_t *link;
+        uthread_tcb *thread = NULL;
+        if (iheap_peek(&(scheduler->timeout_heap), &link) == 0
+                && iheap_entry(link, uthread_tcb, timeout_link)->timeout
+                    <= now) {
+            iheap_pop(&(scheduler->timeout_heap), &link);
+            thread = iheap_entry(link, uthread_tcb, timeout_link);
+            thread->timeout = 0;
+            if (!uthread_claim(thread)) {
+                thread->timeout = -1;
+                thread = NULL;
+            }
+        }
+        uthread_timeout_update(scheduler);
+        uthread_spin_unlock(&(scheduler->timeout_lock));
+        if (thread != NULL) {
+            uthread_wake(thread);
+        }
+    }
+}
+
+// Context switching
+// =============================================================================
+struct uthread_tcb *uthread_current(void) {
+    return uthread_worker()->current_thread;
+}
+
+// Switch from the current thread of @worker to @next_thread, the current one
+// going to @prev_state once its context is saved (preemption disabled)
+// Returns once the current thread is resumed, possibly on another worker
+void uthread_switch_to(uthread_worker_t *worker, uthread_state_t prev_state,
+        uthread_tcb *next_thread) {
+    uthread_tcb *prev_thread = worker->current_thread;
+    worker->prev_thread = prev_thread;
+    worker->prev_state = prev_state;
+    worker->current_thread = next_thread;
+    this_thread = next_thread;
+    next_thread->sched.pinned = next_thread->home != NULL;
+
+    // A thread switched to on a tick starts a whole time slice, one switched
+    // to in between only gets the rest of the current one
+    next_thread->sched.slice_ticks = worker->tick_switch ? 0 : -1;
+    worker->tick_switch = false;
+    atomic_store_explicit(&(next_thread->state), UTHREAD_RUNNING,
+        memory_order_relaxed);
+
+    // Shared stack threads may need their frames put back on the stack
+    struct uthread_shared_stack *shared_stack = &(worker->shared_stack);
+    bool handoff = next_thread->shared && shared_stack->owner != next_thread;
+
+    if (handoff && prev_thread->shared) {
+        // Those frames would overwrite the ones we are running on: let the
+        // copier context hand the stack over and switch to next thread
+        shared_stack->copy_next = next_thread;
+        uthread_ctx_switch(&(prev_thread->ctx), &(shared_stack->copier_ctx));
+    } else {
+        if (handoff) {
+            uthread_shared_handoff(shared_stack, next_thread);
+        }
+
+        // Switch context
+        uthread_ctx_switch(&(prev_thread->ctx), &(next_thread->ctx));
+    }
+}
+
+// Deal with the thread @worker just switched away from, whose context is now
+// saved so that another worker may resume it (preemption disabled)
+void uthread_switch_finish(uthread_worker_t *worker) {
+    uthread_tcb *prev_thread = worker->prev_thread;
+    worker->prev_thread = NULL;
+
+    switch (worker->prev_state) {
+    case UTHREAD_READY:
+        uthread_ready_enqueue(worker, prev_thread);
+        break;
+    case UTHREAD_BLOCKED: {
+        // Park the thread, unless it got unblocked during the switch. The
+        // policy must be done with it before any worker can wake it.
+        uthread_state_t running = UTHREAD_RUNNING;
+        uthread_policy_block(worker, prev_thread);
+        if (atomic_compare_exchange_strong(&(prev_thread->state), &running,
+                UTHREAD_BLOCKED)) {
+            uthread_runnable_dec(worker->scheduler);
+        } else {
+            uthread_policy_wake(worker, prev_thread, NULL);
+            uthread_ready_enqueue(worker, prev_thread);
+        }
+        break;
+    }
+    case UTHREAD_ZOMBIE:
+        atomic_store(&(prev_thread->state), UTHREAD_ZOMBIE);
+        uthread_pool_put(&(worker->scheduler->thread_pool), prev_thread);
+        uthread_runnable_dec(worker->scheduler);
+        break;
+    default:
+        // Idle loop, nothing to do
+        break;
+    }
+}
+
+void uthread_resume(void) {
+    uthread_switch_finish(uthread_worker());
+
+    // Back to running, exiting critical section
+    preempt_enable();
+}
+
+// Swap threads from current thread to the next ready one
+// Called with preemption disabled, which stays disabled across the context
+// switch and is only re-enabled once this thread is resumed
+void uthread_swap_threads(uthread_state_t prev_state) {
+    uthread_worker_t *worker = uthread_worker();
+    if (worker->scheduler->policy->account) {
+        uthread_account(worker);
+    }
+    uthread_timeout_expire(worker);
+
+    // A thread staying ready only makes way for the threads that the policy
+    // would run before it
+    uthread_tcb *current_thread = NULL;
+    if (prev_state == UTHREAD_READY) {
+        current_thread = worker->current_thread;
+    }
+
+    // Retrieve next ready thread, from another worker if there is none here
+    uthread_tcb *next_thread = uthread_ready_dequeue(worker, current_thread);
+    if (next_thread == NULL) {
+        next_thread = uthread_ready_steal(worker, current_thread);
+    }
+    if (next_thread == NULL) {
+        if (prev_state == UTHREAD_READY) {
+            // Nothing else to run, keep going, without ticks unless other
+            // threads are waiting for their turn
+            worker->tick_switch = false;
+            if (atomic_load(&(worker->ready_length)) == 0) {
+                uthread_tick_stop(worker);
+            }
+            preempt_enable();
+            return;
+        }
+        next_thread = &(worker->idle_thread);
+    }
+
+    uthread_switch_to(worker, prev_state, next_thread);
+    uthread_resume();
+}
+
+void uthread_yield(void) {
+    // Go back to the ready queue once switched out (atomic)
+    preempt_disable();
 
     // Swap to next ready thread
-    uthread_swap_threads();
+    uthread_swap_threads(UTHREAD_READY);
+}
+
+// A thread preempted by the timer may have been interrupted between computing
+// the address of a thread-local variable of its kernel thread and accessing it.
+// This is harmless on x86-64, where such accesses are a single instruction
+// relative to the %fs segment, but elsewhere the thread must be resumed on the
+// same worker.
+#if defined(__x86_64__)
+#define UTHREAD_PREEMPT_PIN false
+#else
+#define UTHREAD_PREEMPT_PIN true
+#endif
+
+void uthread_preempt(void) {
+    // Go back to the ready queue once switched out (atomic). The alarm that
+    // led here is blocked until the signal handler returns, which may take a
+    // while: let the next ones in, now that they can only be left pending.
+    preempt_disable();
+    preempt_unblock();
+    uthread_worker_t *worker = uthread_worker();
+    uthread_tcb *current_thread = worker->current_thread;
+    if (UTHREAD_PREEMPT_PIN) {
+        current_thread->sched.pinned = true;
+    }
+
+    // Let the policy react to the tick before picking the next thread
+    const uthread_policy_t *policy = worker->scheduler->policy;
+    ++(current_thread->sched.slice_ticks);
+    if (policy->on_tick != NULL) {
+        policy->on_tick(worker->policy_data, &(current_thread->sched));
+    }
+    worker->tick_switch = true;
+
+    // Swap to next ready thread
+    uthread_swap_threads(UTHREAD_READY);
 }
 
 void uthread_exit(void) {
-    // Enqueue current thread into zombie queue (atomic)
+    // Recycle current thread, or free it if the pool is full, once switched
+    // out, as its stack is in use until then (atomic)
     preempt_disable();
-    queue_enqueue(zombie_queue, current_thread);
-    preempt_enable();
+    uthread_worker_t *worker = uthread_worker();
+    uthread_tcb *current_thread = worker->current_thread;
+    uthread_deadline_end(worker->scheduler, current_thread);
+    uthread_stack_record(current_thread);
+    if (worker->shared_stack.owner == current_thread) {
+        // Frames left on the shared stack are dead, nothing to save
+        worker->shared_stack.owner = NULL;
+    }
 
     // Swap to next ready thread
-    uthread_swap_threads();
+    uthread_swap_threads(UTHREAD_ZOMBIE);
 }
 
-int uthread_create(uthread_func_t func, void *arg) {
-    uthread_tcb *new_thread = malloc(sizeof(uthread_tcb));
-    if (new_thread == NULL) {
-        // ERROR: Bad malloc
+// Thread creation
+// =============================================================================
+int uthread_attr_init(uthread_attr_t *attr) {
+    if (attr == NULL) {
         return -1;
     }
+    attr->stack_size = UTHREAD_STACK_SIZE;
+    attr->shared_stack = false;
+    attr->priority = UTHREAD_PRIORITY_DEFAULT;
+    attr->weight = UTHREAD_WEIGHT_DEFAULT;
+    return 0;
+}
 
-    // Initialize new thread
-    new_thread->stack_head = uthread_ctx_alloc_stack();
-    if (new_thread->stack_head == NULL) {
-        // ERROR: Failed to alloc stack
+int uthread_attr_setstacksize(uthread_attr_t *attr, size_t stack_size) {
+    if (attr == NULL) {
         return -1;
     }
+    attr->stack_size = stack_size;
+    return 0;
+}
 
-    int retval = uthread_ctx_init(&(new_thread->ctx), new_thread->stack_head, 
-        func, arg);
-    if (retval <= -1) {
-        // ERROR: Init context failed
+int uthread_attr_setsharedstack(uthread_attr_t *attr, bool shared_stack) {
+    if (attr == NULL) {
         return -1;
     }
+    attr->shared_stack = shared_stack;
+    return 0;
+}
 
-    // Enqueue current thread into ready queue (atomic)
-    preempt_disable();
-    queue_enqueue(ready_queue, new_thread);
-    preempt_enable();
+int uthread_attr_setpriority(uthread_attr_t *attr, int priority) {
+    if (attr == NULL || priority < 0 || priority >= UTHREAD_PRIORITIES) {
+        return -1;
+    }
+    attr->priority = priority;
+    return 0;
+}
 
+int uthread_attr_setweight(uthread_attr_t *attr, int weight) {
+    if (attr == NULL || weight <= 0) {
+        return -1;
+    }
+    attr->weight = weight;
     return 0;
 }
 
-// Empty out a queue and free tcb mallocs
-void uthread_free_queue(queue_t target_queue) {
-    // Disable preempt, entering critical section
+int uthread_create(uthread_func_t func, void *arg) {
+    return uthread_create_ex(NULL, func, arg);
+}
+
+int uthread_create_ex(const uthread_attr_t *attr, uthread_func_t func,
+        void *arg) {
+    bool shared = attr != NULL && attr->shared_stack;
+    size_t stack_size = shared ? 0
+        : uthread_ctx_stack_size(attr ? attr->stack_size : 0);
+
+    // Reuse an exited thread and its stack if possible (atomic). Shared stack
+    // threads are pinned to the worker whose shared stack they use.
+    // The whole creation is atomic: a thread preempted in the middle of
+    // malloc() would leave the allocator inconsistent for the next thread of
+    // the worker to call it (glibc does not even lock it until the process
+    // has several kernel threads).
     preempt_disable();
+    uthread_worker_t *worker = uthread_worker();
+    uthread_worker_t *home = NULL;
+    if (shared) {
+        home = worker;
+        if (uthread_shared_init(&(home->shared_stack)) < 0) {
+            // ERROR: Failed to alloc shared stack
+            preempt_enable();
+            return -1;
+        }
+    }
+    uthread_tcb *new_thread = uthread_pool_get(
+        &(worker->scheduler->thread_pool), stack_size);
+
+    if (new_thread == NULL) {
+        new_thread = malloc(sizeof(uthread_tcb));
+        if (new_thread == NULL) {
+            // ERROR: Bad malloc
+            preempt_enable();
+            return -1;
+        }
 
-    while (queue_length(target_queue) > 0) {
-        uthread_tcb* target_thread;
-        queue_dequeue(target_queue, (void**)&target_thread);
-        if (target_thread != NULL) {
-            uthread_ctx_destroy_stack(target_thread->stack_head);
-            free(target_thread);
+        new_thread->stack_size = stack_size;
+        new_thread->stack_painted = 0;
+        new_thread->save_buf = NULL;
+        new_thread->save_size = 0;
+        new_thread->save_capacity = 0;
+        new_thread->stack_head = NULL;
+        if (!shared) {
+            new_thread->stack_head = uthread_ctx_alloc_stack(stack_size);
+            if (new_thread->stack_head == NULL) {
+                // ERROR: Failed to alloc stack
+                free(new_thread);
+                preempt_enable();
+                return -1;
+            }
         }
     }
+    new_thread->func = func;
+    new_thread->arg = arg;
+    new_thread->shared = shared;
+    new_thread->home = home;
+    new_thread->sched = (struct uthread_sched){
+        .priority = attr ? attr->priority : UTHREAD_PRIORITY_DEFAULT,
+        .weight = attr ? attr->weight : UTHREAD_WEIGHT_DEFAULT,
+        .pinned = home != NULL,
+    };
+    new_thread->sched.level = new_thread->sched.priority;
+    new_thread->deadline = 0;
+    new_thread->wait_status = 0;
+    new_thread->timeout = 0;
 
-    // Reenable preempt, exiting critical section
+    // Shared stack threads get their context once they first get the stack
+    if (shared) {
+        new_thread->fresh = true;
+        new_thread->save_size = 0;
+    } else {
+        // Paint the stack to measure its usage at exit: a fresh stack
+        // entirely, a recycled one only down to where it was used
+        if (stack_stats.enabled) {
+            uthread_ctx_paint_stack(new_thread->stack_head,
+                new_thread->stack_size, new_thread->stack_painted
+                    ? new_thread->stack_painted : new_thread->stack_size);
+            if (new_thread->stack_painted == 0) {
+                new_thread->stack_painted = new_thread->stack_size;
+            }
+        } else {
+            new_thread->stack_painted = 0;
+        }
+
+        // Initialize new thread
+        int retval = uthread_ctx_init(&(new_thread->ctx),
+            new_thread->stack_head, new_thread->stack_size, func, arg);
+        if (retval <= -1) {
+            // ERROR: Init context failed
+            uthread_destroy(new_thread);
+            preempt_enable();
+            return -1;
+        }
+    }
+
+    // Enqueue new thread into ready queue, running it right away if the policy
+    // says so
+    bool yield = uthread_wake(new_thread);
     preempt_enable();
+    if (yield) {
+        uthread_yield();
+    }
+
+    return 0;
+}
+
+// Workers
+// =============================================================================
+// Idle loop of a worker, on the worker's kernel thread stack with preemption
+// disabled: runs ready threads until there are no runnable threads left
+void uthread_idle(uthread_worker_t *worker) {
+    uthread_scheduler_t *scheduler = worker->scheduler;
+    while (atomic_load(&(scheduler->runnable)) > 0
+            || uthread_timeout_pending(scheduler)) {
+        uthread_timeout_expire(worker);
+        uthread_tcb *next_thread = uthread_ready_dequeue(worker, NULL);
+        if (next_thread == NULL) {
+            next_thread = uthread_ready_steal(worker, NULL);
+        }
+        if (next_thread != NULL) {
+            if (scheduler->policy->account) {
+                uthread_account(worker);
+            }
+            uthread_switch_to(worker, UTHREAD_RUNNING, next_thread);
+            uthread_switch_finish(worker);
+            continue;
+        }
+
+        // Sleep until a thread is made ready, the earliest timeout or the
+        // last thread is gone. Ready threads that cannot be stolen belong to
+        // a busy worker: let it run.
+        uthread_tick_stop(worker);
+        pthread_mutex_lock(&(scheduler->idle_lock));
+        atomic_fetch_add(&(scheduler->sleepers), 1);
+        bool nothing_ready = uthread_ready_total(scheduler) == 0;
+        int64_t next_timeout = atomic_load(&(scheduler->next_timeout));
+        if (nothing_ready && next_timeout != INT64_MAX) {
+            // The condition waits on the realtime clock
+            struct timespec ts;
+            int64_t wait = next_timeout - uthread_now();
+            clock_gettime(CLOCK_REALTIME, &ts);
+            if (wait > 0) {
+                wait += ts.tv_nsec;
+                ts.tv_sec += wait / 1000000000LL;
+                ts.tv_nsec = wait % 1000000000LL;
+                pthread_cond_timedwait(&(scheduler->idle_cond),
+                    &(scheduler->idle_lock), &ts);
+            }
+        } else if (nothing_ready && atomic_load(&(scheduler->runnable)) > 0) {
+            pthread_cond_wait(&(scheduler->idle_cond),
+                &(scheduler->idle_lock));
+        }
+        atomic_fetch_sub(&(scheduler->sleepers), 1);
+        pthread_mutex_unlock(&(scheduler->idle_lock));
+        if (!nothing_ready) {
+            sched_yield();
+        }
+    }
+    uthread_tick_stop(worker);
+}
+
+// Body of the kernel threads started for the workers after the first one
+void *uthread_worker_main(void *arg) {
+    this_worker = arg;
+    uthread_scheduler_t *scheduler = this_worker->scheduler;
+    preempt_start(scheduler->preempt, scheduler->clock, &(this_worker->timer));
+    uthread_idle(this_worker);
+    preempt_stop(&(this_worker->timer));
+    this_worker = NULL;
+    return NULL;
+}
+
+int uthread_run_attr_init(uthread_run_attr_t *attr) {
+    if (attr == NULL) {
+        return -1;
+    }
+    attr->preempt = false;
+    attr->workers = 1;
+    attr->quantum = UTHREAD_QUANTUM;
+    attr->clock = CLOCK_THREAD_CPUTIME_ID;
+    attr->policy = &uthread_policy_fifo;
+    return 0;
 }
 
 int uthread_run(bool preempt, uthread_func_t func, void *arg) {
-    // Init scheduler
-    ready_queue   = queue_create();
-    blocked_queue = queue_create();
-    zombie_queue  = queue_create();
-
-    // Create user and idle thread
-    int idle_retval = uthread_create(NULL, NULL);
-    int user_retval = uthread_create(func, arg);
-    if (idle_retval < 0 || user_retval < 0) {
-        // ERROR: Thread creation failed
+    uthread_run_attr_t attr;
+    uthread_run_attr_init(&attr);
+    attr.preempt = preempt;
+    return uthread_run_ex(&attr, func, arg);
+}
+
+int uthread_run_ex(const uthread_run_attr_t *attr, uthread_func_t func,
+        void *arg) {
+    uthread_run_attr_t default_attr;
+    if (attr == NULL) {
+        uthread_run_attr_init(&default_attr);
+        attr = &default_attr;
+    }
+    int num_workers = attr->workers > 1 ? attr->workers : 1;
+    if (this_worker != NULL) {
+        // ERROR: Already running a scheduler on this kernel thread
+        return -1;
+    }
+    if (attr->preempt && (attr->quantum <= 0
+            || clock_getres(attr->clock, NULL) == -1)) {
+        // ERROR: Invalid time slice or clock
         return -1;
     }
 
-    // Set idle thread as initial current thread
-    queue_dequeue(ready_queue, (void**)&current_thread);
+    // Init this kernel thread's scheduler instance
+    const uthread_policy_t *policy = attr->policy != NULL ? attr->policy
+        : &uthread_policy_fifo;
+    uthread_scheduler_t *scheduler = &local_scheduler;
+    uthread_worker_t *workers = calloc(num_workers, sizeof(uthread_worker_t));
+    if (workers == NULL) {
+        // ERROR: Bad malloc
+        return -1;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (uthread_ready_init(&(workers[i]), policy) < 0) {
+            // ERROR: Failed to create ready queue
+            while (i-- > 0) {
+                uthread_ready_destroy(&(workers[i]), policy);
+            }
+            free(workers);
+            return -1;
+        }
+        workers[i].id = i;
+        workers[i].scheduler = scheduler;
+        workers[i].current_thread = &(workers[i].idle_thread);
+        preempt_timer_init(&(workers[i].timer), attr->quantum);
+    }
+    scheduler->workers = workers;
+    scheduler->num_workers = num_workers;
+    scheduler->preempt = attr->preempt;
+    scheduler->policy = policy;
+    scheduler->clock = attr->clock;
+    atomic_store(&(scheduler->runnable), 0);
+    uthread_spin_init(&(scheduler->timeout_lock));
+    iheap_init(&(scheduler->timeout_heap), uthread_timeout_cmp);
+    atomic_store(&(scheduler->next_timeout), INT64_MAX);
 
-    // Preemption init
-    preempt_start(preempt);
+    // The calling kernel thread is the first worker
+    this_worker = &(workers[0]);
 
-    // Idle loop
-    while (1) {
-        // Free zombies if any exist 
-        uthread_free_queue(zombie_queue);
+    // Create user thread
+    if (uthread_create(func, arg) < 0) {
+        // ERROR: Thread creation failed
+        for (int i = 0; i < num_workers; i++) {
+            uthread_ready_destroy(&(workers[i]), policy);
+        }
+        scheduler->workers = NULL;
+        scheduler->num_workers = 0;
+        this_worker = NULL;
+        free(workers);
+        return -1;
+    }
 
-        // Exit the idle loop when ready queue is empty
-        int num_threads = queue_length(ready_queue);
-        if (num_threads == 0) {
+    // Preemption init, left disabled on the idle loops (each worker starts
+    // its own)
+    preempt_start(scheduler->preempt, scheduler->clock, &(this_worker->timer));
+
+    // Start the other workers
+    int started = 1;
+    while (started < num_workers) {
+        if (pthread_create(&(workers[started].pthread), NULL,
+                uthread_worker_main, &(workers[started])) != 0) {
+            // ERROR: Failed to start a worker, carry on with the others
             break;
         }
-        
-        // Swap to the next thread
-        uthread_yield();
+        ++started;
+    }
+
+    // Run threads until they are all done
+    uthread_idle(this_worker);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].pthread, NULL);
     }
 
     // Stop preemption
+    preempt_stop(&(this_worker->timer));
+
+    // Free the threads cached in the pool and the workers
+    uthread_pool_trim(&(scheduler->thread_pool), 0);
+    for (int i = 0; i < num_workers; i++) {
+        uthread_shared_destroy(&(workers[i].shared_stack));
+        uthread_ready_destroy(&(workers[i]), policy);
+    }
+    scheduler->workers = NULL;
+    scheduler->num_workers = 0;
+    this_worker = NULL;
+    free(workers);
+    return 0;
+}
+
+int uthread_set_quantum(long quantum) {
+    if (quantum <= 0) {
+        // ERROR: Invalid time slice
+        return -1;
+    }
+    uthread_scheduler_t *scheduler = uthread_scheduler();
+    if (!scheduler->preempt) {
+        // ERROR: Not running a preemptive scheduler
+        return -1;
+    }
+
+    // Every worker has its own timer (atomic)
     preempt_disable();
-    preempt_stop();
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        preempt_set_quantum(&(scheduler->workers[i].timer), quantum);
+    }
+    preempt_enable();
+    return 0;
+}
 
-    // Free current thread
-    uthread_ctx_destroy_stack(current_thread->stack_head);
-    free(current_thread);
+int uthread_set_priority(int priority) {
+    if (priority < 0 || priority >= UTHREAD_PRIORITIES) {
+        // ERROR: Invalid priority
+        return -1;
+    }
 
-    // Destroy queues
-    queue_destroy(blocked_queue);
-    queue_destroy(zombie_queue);
-    queue_destroy(ready_queue);
+    // Make way for the ready threads that the policy now runs first (atomic)
+    preempt_disable();
+    uthread_tcb *current_thread = uthread_current();
+    current_thread->sched.priority = priority;
+    current_thread->sched.level = priority;
+    preempt_enable();
+    uthread_yield();
     return 0;
 }
 
+int uthread_set_weight(int weight) {
+    if (weight <= 0) {
+        // ERROR: Invalid weight
+        return -1;
+    }
+
+    preempt_disable();
+    uthread_current()->sched.weight = weight;
+    preempt_enable();
+    return 0;
+}
+
+// Blocking
+// =============================================================================
+queue_link_t *uthread_wait_link(struct uthread_tcb *uthread) {
+    return &(uthread->wait_link);
+}
+
+struct uthread_tcb *uthread_from_wait_link(queue_link_t *link) {
+    return iqueue_entry(link, uthread_tcb, wait_link);
+}
+
+int *uthread_wait_status(struct uthread_tcb *uthread) {
+    return &(uthread->wait_status);
+}
+
 // Block the current thread
 void uthread_block(void) {
-    // Enqueue current thread into blocked queue (atomic)
     preempt_disable();
-    queue_enqueue(blocked_queue, current_thread);
-    preempt_enable();
 
-    // Swap to next available thread
-    uthread_swap_threads();
+    // Consume a wake up that came in before the thread could block
+    uthread_tcb *current_thread = uthread_current();
+    uthread_state_t wakeup = UTHREAD_WAKEUP;
+    if (atomic_compare_exchange_strong(&(current_thread->state), &wakeup,
+            UTHREAD_RUNNING)) {
+        preempt_enable();
+        return;
+    }
+
+    // Swap to next available thread, parking this one once switched out
+    uthread_swap_threads(UTHREAD_BLOCKED);
+}
+
+// Take a thread out of its blocked state (preemption disabled)
+// A blocked thread is claimed, to be made runnable by the caller, while one
+// that has yet to be switched out gets a wake up that its uthread_block() call
+// consumes. The state tells which without searching any queue.
+// Returns whether the thread was blocked and claimed
+bool uthread_claim(uthread_tcb *uthread) {
+    uthread_state_t state = atomic_load(&(uthread->state));
+    while (1) {
+        if (state == UTHREAD_BLOCKED) {
+            if (atomic_compare_exchange_weak(&(uthread->state), &state,
+                    UTHREAD_READY)) {
+                return true;
+            }
+        } else if (state == UTHREAD_RUNNING) {
+            if (atomic_compare_exchange_weak(&(uthread->state), &state,
+                    UTHREAD_WAKEUP)) {
+                return false;
+            }
+        } else {
+            // Already awake
+            return false;
+        }
+    }
 }
 
 // Unblock a target thread (atomic)
 void uthread_unblock(struct uthread_tcb *uthread) {
     // Disable preempt, entering critical section
     preempt_disable();
-
-    // Delete from blocked queue and add to ready queue if it existed
-    int retval = queue_delete(blocked_queue, uthread);
-    if (retval == 0) {
-        queue_enqueue(ready_queue, uthread);
-    }
+    bool yield = uthread_claim(uthread) && uthread_wake(uthread);
 
     // Reenable preempt, exiting critical section
     preempt_enable();
+
+    // Let a woken up thread that should run first do so right away
+    if (yield) {
+        uthread_yield();
+    }
+}
+
+// Unblock a target thread and run it right away (atomic)
+void uthread_handoff(struct uthread_tcb *uthread) {
+    preempt_disable();
+    if (!uthread_claim(uthread)) {
+        preempt_enable();
+        return;
+    }
+
+    // Threads pinned to another worker, and threads that should not run
+    // before a deadline thread, go through the ready threads
+    uthread_worker_t *worker = uthread_worker();
+    uthread_tcb *current_thread = worker->current_thread;
+    if ((uthread->home != NULL && uthread->home != worker)
+            || (current_thread->deadline != 0 && (uthread->deadline == 0
+                || uthread->deadline >= current_thread->deadline))) {
+        bool yield = uthread_wake(uthread);
+        preempt_enable();
+        if (yield) {
+            uthread_yield();
+        }
+        return;
+    }
+
+    // Let the policy place the thread as if it had been made ready, then
+    // switch to it, the current thread going back to the ready threads
+    atomic_fetch_add(&(worker->scheduler->runnable), 1);
+    uthread_policy_wake(worker, uthread, NULL);
+    if (worker->scheduler->policy->account) {
+        uthread_account(worker);
+    }
+    uthread_switch_to(worker, UTHREAD_READY, uthread);
+    uthread_resume();
+}
+
+// Claim the blocked threads of a waiting queue (atomic)
+int uthread_claim_queue(iqueue_t *waiting, iqueue_t *claimed) {
+    int count = 0;
+    queue_link_t *link;
+    while (iqueue_dequeue(waiting, &link) == 0) {
+        if (uthread_claim(uthread_from_wait_link(link))) {
+            iqueue_enqueue(claimed, link);
+            ++count;
+        }
+    }
+    return count;
+}
+
+// Make claimed threads ready in one go (atomic)
+void uthread_wake_queue(iqueue_t *claimed) {
+    uthread_worker_t *worker = uthread_worker();
+    iqueue_t local;
+    iqueue_init(&local);
+
+    // Let the policy place each thread, without the lock, then insert them
+    // all under a single lock of the worker
+    int count = 0;
+    queue_link_t *link;
+    while (iqueue_dequeue(claimed, &link) == 0) {
+        uthread_tcb *thread = uthread_from_wait_link(link);
+        if (thread->home != NULL && thread->home != worker) {
+            // Pinned to another worker, which gets it on its own
+            uthread_wake(thread);
+            continue;
+        }
+        uthread_policy_wake(worker, thread, NULL);
+        iqueue_enqueue(&local, link);
+        ++count;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    atomic_fetch_add(&(worker->scheduler->runnable), count);
+    uthread_spin_lock(&(worker->lock));
+    while (iqueue_dequeue(&local, &link) == 0) {
+        uthread_ready_insert(worker, uthread_from_wait_link(link));
+    }
+    atomic_fetch_add(&(worker->ready_length), count);
+    uthread_spin_unlock(&(worker->lock));
+
+    uthread_tick_start(worker);
+    uthread_idle_kick(worker->scheduler);
 }
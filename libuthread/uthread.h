@@ -2,6 +2,11 @@
 #define _UTHREAD_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "policy.h"
 
 /*
  * uthread_func_t - Thread function type
@@ -9,6 +14,113 @@
  */
 typedef void (*uthread_func_t)(void *arg);
 
+/* Default size of the stack for a thread (in bytes) */
+#define UTHREAD_STACK_SIZE 32768
+
+/* Size of the stack shared by threads in shared stack mode (in bytes) */
+#define UTHREAD_SHARED_STACK_SIZE (1024 * 1024)
+
+/* Default preemption time slice (in microseconds) */
+#define UTHREAD_QUANTUM 10000
+
+/* Number of thread priority levels, from 0 (highest) to UTHREAD_PRIORITIES - 1 */
+#define UTHREAD_PRIORITIES 8
+
+/* Priority level of threads created without a priority attribute */
+#define UTHREAD_PRIORITY_DEFAULT 3
+
+/* Weight of threads created without a weight attribute, for fair scheduling */
+#define UTHREAD_WEIGHT_DEFAULT 1024
+
+/*
+ * uthread_attr_t - Thread creation attributes
+ * @stack_size: Size of the thread's stack in bytes, rounded up to a whole
+ *	number of pages. 0 selects UTHREAD_STACK_SIZE.
+ * @shared_stack: Run the thread on the shared stack instead of its own
+ * @priority: Priority level of the thread, UTHREAD_PRIORITY_DEFAULT by default
+ * @weight: CPU share of the thread with fair scheduling,
+ *	UTHREAD_WEIGHT_DEFAULT by default
+ *
+ * Attributes must be initialized with uthread_attr_init() before being set,
+ * so that fields added later get their default value.
+ */
+typedef struct uthread_attr {
+	size_t stack_size;
+	bool shared_stack;
+	int priority;
+	int weight;
+} uthread_attr_t;
+
+/*
+ * uthread_attr_init - Initialize thread attributes to their default values
+ * @attr: Attributes to initialize
+ *
+ * Return: -1 if @attr is NULL, 0 otherwise.
+ */
+int uthread_attr_init(uthread_attr_t *attr);
+
+/*
+ * uthread_attr_setstacksize - Set the stack size of thread attributes
+ * @attr: Attributes to modify
+ * @stack_size: Size of the stack in bytes
+ *
+ * Stacks are mapped right above an inaccessible guard page: a thread that
+ * overflows its stack faults deterministically instead of corrupting memory.
+ * Stack pages are only committed once touched, but a stack must still be large
+ * enough to also hold the frame of a preemption signal.
+ *
+ * Return: -1 if @attr is NULL, 0 otherwise.
+ */
+int uthread_attr_setstacksize(uthread_attr_t *attr, size_t stack_size);
+
+/*
+ * uthread_attr_setsharedstack - Select the shared stack mode
+ * @attr: Attributes to modify
+ * @shared_stack: Whether the thread runs on the shared stack
+ *
+ * Threads in shared stack mode have no stack of their own: they run on a
+ * single stack of UTHREAD_SHARED_STACK_SIZE bytes. When another shared stack
+ * thread needs to run, the live part of the stack is copied out to a buffer
+ * sized to fit, and copied back when the thread is resumed. A blocked thread
+ * therefore only costs the memory its frames actually use, in exchange for a
+ * copy on some context switches. The stack size attribute is ignored.
+ *
+ * As their frames move in and out of the shared stack, such threads must not
+ * let other threads access variables that live on their stack.
+ *
+ * Return: -1 if @attr is NULL, 0 otherwise.
+ */
+int uthread_attr_setsharedstack(uthread_attr_t *attr, bool shared_stack);
+
+/*
+ * uthread_attr_setpriority - Set the priority of thread attributes
+ * @attr: Attributes to modify
+ * @priority: Priority level, from 0 (highest) to UTHREAD_PRIORITIES - 1
+ *
+ * With the default policy, a worker always runs the ready threads of the
+ * highest priority level first, in round-robin order within a level. Threads
+ * of lower levels only run when no thread of a higher level is ready, so they
+ * can be starved by threads of higher priority that never block. Policies may
+ * also ignore priorities (see policy.h).
+ *
+ * Return: -1 if @attr is NULL or @priority is out of range, 0 otherwise.
+ */
+int uthread_attr_setpriority(uthread_attr_t *attr, int priority);
+
+/*
+ * uthread_attr_setweight - Set the weight of thread attributes
+ * @attr: Attributes to modify
+ * @weight: Weight of the thread, relative to UTHREAD_WEIGHT_DEFAULT
+ *
+ * With uthread_policy_fair, threads competing for a worker get shares of its
+ * CPU time proportional to their weight: a thread of weight 2048 runs twice as
+ * long as one of the default weight. The other built-in policies ignore the
+ * weight.
+ *
+ * Return: -1 if @attr is NULL or @weight is not positive, 0 otherwise.
+ */
+int uthread_attr_setweight(uthread_attr_t *attr, int weight);
+
 /*
  * uthread_run - Run the multithreading library
  * @preempt: Preemption enable
@@ -26,6 +138,150 @@ typedef void (*uthread_func_t)(void *arg);
  */
 int uthread_run(bool preempt, uthread_func_t func, void *arg);
 
+/*
+ * uthread_run_attr_t - Scheduler attributes
+ * @preempt: Enable preemptive scheduling
+ * @workers: Number of kernel threads running the threads, 1 by default
+ * @quantum: Length of the preemption time slices in microseconds,
+ *	UTHREAD_QUANTUM by default. Can go down to tens of microseconds, at the
+ *	cost of more frequent signals and context switches.
+ * @clock: Clock measuring the time slices of each worker,
+ *	CLOCK_THREAD_CPUTIME_ID by default (CPU time of the worker's kernel
+ *	thread). CLOCK_MONOTONIC slices wall-clock time, whether or not the
+ *	worker gets the CPU, and CLOCK_PROCESS_CPUTIME_ID counts the CPU time
+ *	of all the threads of the process. Each worker still has its own timer
+ *	on that clock, and every one of them counts the CPU time of the whole
+ *	process, unrelated pthreads included: with N threads busy, a worker's
+ *	slice lasts about 1/N of @quantum of its own CPU time.
+ * @policy: Scheduling policy deciding which ready thread each worker runs
+ *	next, &uthread_policy_fifo by default. The library comes with
+ *	uthread_policy_fifo, uthread_policy_mlfq, uthread_policy_fair and
+ *	uthread_policy_lifo, and applications can provide their own (see
+ *	policy.h).
+ *
+ * Attributes must be initialized with uthread_run_attr_init() before being
+ * set, so that fields added later get their default value.
+ */
+typedef struct uthread_run_attr {
+	bool preempt;
+	int workers;
+	long quantum;
+	clockid_t clock;
+	const uthread_policy_t *policy;
+} uthread_run_attr_t;
+
+/*
+ * uthread_run_attr_init - Initialize scheduler attributes to their defaults
+ * @attr: Attributes to initialize
+ *
+ * Return: -1 if @attr is NULL, 0 otherwise.
+ */
+int uthread_run_attr_init(uthread_run_attr_t *attr);
+
+/*
+ * uthread_run_ex - Run the multithreading library with attributes
+ * @attr: Scheduler attributes, or NULL for the default attributes
+ * @func: Function of the first thread to start
+ * @arg: Argument to be passed to the first thread
+ *
+ * Same as uthread_run(), but the scheduler is configured according to @attr.
+ *
+ * With more than one worker, the calling kernel thread is joined by @workers -
+ * 1 new ones (pthreads). Each worker runs threads from its own ready threads,
+ * where the threads it creates, unblocks or preempts go, and steals a ready
+ * thread of another worker when it has none. Threads therefore run
+ * in parallel and may be resumed on any worker, and must protect the data they
+ * share with semaphores rather than rely on yielding. Shared stack threads are
+ * the exception: they stay on the worker that created them.
+ *
+ * With preemption, each worker has its own timer, whose SIGVTALRM alarms are
+ * delivered to the worker's kernel thread only: the other threads of the
+ * process are never interrupted. The signal handler is still process-wide, so
+ * the process must not use SIGVTALRM for anything else meanwhile.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
+ * context creation, invalid quantum or clock).
+ */
+int uthread_run_ex(const uthread_run_attr_t *attr, uthread_func_t func,
+		   void *arg);
+
+/*
+ * uthread_set_quantum - Change the preemption time slice
+ * @quantum: Length of a time slice in microseconds
+ *
+ * To be called from a thread of a preemptive scheduler. All the workers of the
+ * scheduler get the new time slice, starting from now.
+ *
+ * Return: -1 if @quantum is not positive or if the scheduler is not
+ * preemptive, 0 otherwise.
+ */
+int uthread_set_quantum(long quantum);
+
+/*
+ * uthread_set_priority - Change the priority of the current thread
+ * @priority: Priority level, from 0 (highest) to UTHREAD_PRIORITIES - 1
+ *
+ * The thread is also brought back to that level if uthread_policy_mlfq demoted
+ * it. It then yields, making way for the ready threads of its worker that the
+ * policy runs first, such as the ones of at least its new priority with the
+ * default policy.
+ *
+ * With the default policy, a thread made ready by uthread_create() or sem_up()
+ * with a higher priority than the current thread of the same worker runs right
+ * away.
+ *
+ * Return: -1 if @priority is out of range, 0 otherwise.
+ */
+int uthread_set_priority(int priority);
+
+/*
+ * uthread_set_weight - Change the weight of the current thread
+ * @weight: Weight of the thread, relative to UTHREAD_WEIGHT_DEFAULT
+ *
+ * Return: -1 if @weight is not positive, 0 otherwise.
+ */
+int uthread_set_weight(int weight);
+
+/*
+ * uthread_set_deadline - Set or clear the deadline of the current thread
+ * @deadline: Time from now to be done by, in microseconds, or 0 to clear it
+ *
+ * Ready threads with a deadline run before any thread without one, earliest
+ * deadline first, whatever their priority or weight. A thread with a deadline
+ * is only preempted for a thread with an earlier deadline, and only yields to
+ * those. A deadline thread made ready by uthread_create() or sem_up() on the
+ * worker of a thread it should run before runs right away.
+ *
+ * The thread is done with its previous deadline, if any, which is counted as
+ * met or missed (see uthread_deadline_get_stats()). A thread exiting is done
+ * with its deadline as well.
+ *
+ * Return: -1 if @deadline is negative, 0 otherwise.
+ */
+int uthread_set_deadline(long deadline);
+
+/*
+ * uthread_deadline_stats - Deadline counters
+ * @met: Deadlines that threads were done with in time
+ * @missed: Deadlines that threads were done with late
+ * @max_lateness: Longest time a thread was done with a deadline late, in
+ *	nanoseconds
+ */
+struct uthread_deadline_stats {
+	size_t met;
+	size_t missed;
+	long max_lateness;
+};
+
+/*
+ * uthread_deadline_get_stats - Get deadline counters
+ * @stats: Address where to copy the counters
+ *
+ * The counters are those of the scheduler instance of the calling kernel
+ * thread, and add up over its runs.
+ */
+void uthread_deadline_get_stats(struct uthread_deadline_stats *stats);
+
 /*
  * uthread_create - Create a new thread
  * @func: Function to be executed by the thread
@@ -39,6 +295,21 @@ int uthread_run(bool preempt, uthread_func_t func, void *arg);
  */
 int uthread_create(uthread_func_t func, void *arg);
 
+/*
+ * uthread_create_ex - Create a new thread with attributes
+ * @attr: Creation attributes, or NULL for the default attributes
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to the thread
+ *
+ * Same as uthread_create(), but the new thread is configured according to
+ * @attr.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
+ * context creation).
+ */
+int uthread_create_ex(const uthread_attr_t *attr, uthread_func_t func,
+		      void *arg);
+
 /*
  * uthread_yield - Yield execution
  *
@@ -57,4 +328,90 @@ void uthread_yield(void);
  */
 void uthread_exit(void);
 
+/*
+ * uthread_pool_stats - Thread pool counters
+ * @hits: Threads created by recycling a pooled TCB and stack
+ * @misses: Threads created with a freshly allocated TCB and stack
+ * @recycled: Exited threads that were put in the pool
+ * @released: Exited threads that were freed because the pool was full
+ * @cached: Threads currently held by the pool
+ */
+struct uthread_pool_stats {
+	size_t hits;
+	size_t misses;
+	size_t recycled;
+	size_t released;
+	size_t cached;
+};
+
+/*
+ * uthread_pool_set_capacity - Set the size of the thread pool
+ * @capacity: Maximum number of exited threads kept for reuse
+ *
+ * Exited threads are kept, along with their stack, in a bounded pool from which
+ * uthread_create() takes first. If the pool currently holds more than
+ * @capacity threads, the extra ones are freed. A @capacity of 0 disables
+ * recycling. The pool is emptied when uthread_run() returns.
+ */
+void uthread_pool_set_capacity(size_t capacity);
+
+/*
+ * uthread_pool_get_stats - Get thread pool counters
+ * @stats: Address where to copy the counters
+ */
+void uthread_pool_get_stats(struct uthread_pool_stats *stats);
+
+/* Number of buckets of a stack usage histogram */
+#define UTHREAD_STACK_HIST_BUCKETS 16
+
+/*
+ * uthread_stack_usage - Stack usage of the threads of an entry function
+ * @func: Entry function of the threads
+ * @threads: Number of measured threads
+ * @max_depth: Deepest stack usage, in bytes
+ * @total_depth: Sum of the stack usage of all threads, in bytes
+ * @histogram: Number of threads per stack usage, where bucket i counts the
+ *	threads that used at most 1 KiB << i (the last bucket also counts deeper
+ *	threads)
+ */
+struct uthread_stack_usage {
+	uthread_func_t func;
+	size_t threads;
+	size_t max_depth;
+	size_t total_depth;
+	size_t histogram[UTHREAD_STACK_HIST_BUCKETS];
+};
+
+/*
+ * uthread_stack_measure - Enable or disable stack usage measurement
+ * @enable: Measure the stack usage of the threads created from now on
+ *
+ * When enabled, the stacks of new threads are painted with a canary pattern
+ * and the peak depth of each stack is measured when its thread exits, then
+ * aggregated per thread entry function. Painting commits every page of a stack
+ * and costs time at thread creation, so measurement is off by default.
+ *
+ * Enabling measurement discards the previously collected usage.
+ */
+void uthread_stack_measure(bool enable);
+
+/*
+ * uthread_stack_get_usage - Get the collected stack usage
+ * @usage: Array to fill with the usage of each entry function
+ * @count: Number of entries @usage can hold
+ *
+ * Return: Total number of entry functions measured so far, which may be more
+ * than @count.
+ */
+int uthread_stack_get_usage(struct uthread_stack_usage *usage, int count);
+
+/*
+ * uthread_stack_dump_usage - Print a stack usage report
+ * @stream: Stream to print to
+ *
+ * Prints the stack usage of each entry function along with a suggested stack
+ * size, typically once uthread_run() has returned.
+ */
+void uthread_stack_dump_usage(FILE *stream);
+
 #endif /* _THREAD_H */